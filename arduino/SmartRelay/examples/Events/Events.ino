@@ -0,0 +1,47 @@
+/*
+  Events
+  --------
+  Reports relay changes and watchdog trips without hand-written polling.
+  SmartRelayEvents polls slowly while nothing is due and tightens the
+  interval around known timer and watchdog deadlines.
+*/
+
+#include <Wire.h>
+#include <SmartRelay.h>
+#include <SmartRelayEvents.h>
+
+SmartRelay relay(0x2A);
+SmartRelayEvents events(relay);
+
+static void onRelayChange(SmartRelay &, const SmartRelayEvent &event, void *) {
+  Serial.print("R");
+  Serial.print(event.relay_id);
+  Serial.print(event.state ? " ON" : " OFF");
+  Serial.println(event.expected ? " (expected)" : "");
+}
+
+static void onWatchdogTrip(SmartRelay &, const SmartRelayEvent &event, void *) {
+  Serial.print("WATCHDOG TRIP ");
+  Serial.println(event.trip_count);
+}
+
+void setup() {
+  Serial.begin(115200);
+  relay.begin(Wire, 100000);
+
+  events.onRelayChange(onRelayChange);
+  events.onWatchdogTrip(onWatchdogTrip);
+
+  // Relay 1 reverts after 5s; the change is reported as expected.
+  events.relayOnFor(1, 5);
+
+  // Watch a 10s watchdog on relay 0 that we deliberately stop pinging.
+  relay.watchdogSetPingTimeout(10);
+  relay.watchdogSetResetDuration(2);
+  relay.watchdogEnable(0);
+  events.watchWatchdog(0, 10, 2);
+}
+
+void loop() {
+  events.update();
+}
@@ -24,6 +24,8 @@ static void printHelp() {
   Serial.println(F("    off <relay>"));
   Serial.println(F("    on_for <relay> <sec>"));
   Serial.println(F("    off_for <relay> <sec>"));
+  Serial.println(F("    on_for_ms <relay> <ms>"));
+  Serial.println(F("    off_for_ms <relay> <ms>"));
   Serial.println(F("- Watchdog mode:"));
   Serial.println(F("    wd_enable <relay>"));
   Serial.println(F("    wd_disable"));
@@ -131,6 +133,24 @@ static void handleLine(char *line) {
     return;
   }
 
+  if (strcmp(cmd, "on_for_ms") == 0) {
+    uint8_t relay_id;
+    uint16_t ms;
+    if (!parse_u8(strtok(nullptr, " "), relay_id)) { Serial.println("BAD_PARAM"); return; }
+    if (!parse_u16(strtok(nullptr, " "), ms)) { Serial.println("BAD_PARAM"); return; }
+    printResult(relay.relayOnForMs(relay_id, ms));
+    return;
+  }
+
+  if (strcmp(cmd, "off_for_ms") == 0) {
+    uint8_t relay_id;
+    uint16_t ms;
+    if (!parse_u8(strtok(nullptr, " "), relay_id)) { Serial.println("BAD_PARAM"); return; }
+    if (!parse_u16(strtok(nullptr, " "), ms)) { Serial.println("BAD_PARAM"); return; }
+    printResult(relay.relayOffForMs(relay_id, ms));
+    return;
+  }
+
   if (strcmp(cmd, "wd_enable") == 0) {
     uint8_t relay_id;
     if (!parse_u8(strtok(nullptr, " "), relay_id)) { Serial.println("BAD_PARAM"); return; }
@@ -1,7 +1,31 @@
 #include "SmartRelay.h"
 
+static const uint8_t crc8_table[256] PROGMEM = {
+  0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+  0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+  0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+  0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+  0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+  0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+  0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+  0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+  0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+  0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+  0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+  0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+  0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+  0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+  0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+  0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3
+};
+
 SmartRelay::SmartRelay(uint8_t address)
-  : _address(address), _wire(&Wire) {}
+  : _address(address), _last_status(STATUS_OK), _io_error(false), _pec(false), _pec_errors(0), _hb_verify_every(8),
+    _hb_since_verify(0), _hb_sent(0), _hb_unverified(0), _hb_nacks(0), _hb_failures(0), _wire(&Wire) {
+  uint8_t addr_w = (uint8_t)(_address << 1);
+  _hb_frame[0] = CMD_WATCHDOG_PING;
+  _hb_frame[1] = crc8(crc8(0, &addr_w, 1), _hb_frame, 1);
+}
 
 void SmartRelay::begin(TwoWire &wire, uint32_t clock_hz) {
   _wire = &wire;
@@ -11,24 +35,68 @@ void SmartRelay::begin(TwoWire &wire, uint32_t clock_hz) {
   }
 }
 
+uint8_t SmartRelay::crc8(uint8_t crc, const uint8_t *data, uint8_t len) {
+  for (uint8_t i = 0; i < len; i++) {
+    crc = pgm_read_byte(&crc8_table[crc ^ data[i]]);
+  }
+  return crc;
+}
+
 bool SmartRelay::sendCommand(uint8_t cmd, const uint8_t *payload, uint8_t payload_len) {
+  _io_error = false;
   _wire->beginTransmission(_address);
   _wire->write(cmd);
   if (payload != nullptr && payload_len > 0) {
     _wire->write(payload, payload_len);
   }
+  if (_pec) {
+    // PEC covers the write address byte, command and payload.
+    uint8_t addr_w = (uint8_t)(_address << 1);
+    uint8_t crc = crc8(crc8(0, &addr_w, 1), &cmd, 1);
+    if (payload != nullptr && payload_len > 0) {
+      crc = crc8(crc, payload, payload_len);
+    }
+    _wire->write(crc);
+  }
   uint8_t result = _wire->endTransmission();
-  return result == 0;
+  if (result != 0) {
+    _io_error = true;
+    return false;
+  }
+  return true;
 }
 
 bool SmartRelay::readResponse(uint8_t *buf, uint8_t len) {
-  uint8_t received = _wire->requestFrom(_address, len);
-  if (received != len) {
+  uint8_t frame_len = _pec ? (uint8_t)(len + 1) : len;
+  uint8_t received = _wire->requestFrom(_address, frame_len);
+  if (received != frame_len) {
+    // Aborted mid-transfer: drop the partial frame so it cannot be mistaken
+    // for the start of the next response.
+    while (_wire->available()) {
+      _wire->read();
+    }
+    _io_error = true;
     return false;
   }
   for (uint8_t i = 0; i < len; i++) {
     buf[i] = _wire->read();
   }
+  if (!_pec) {
+    _last_status = buf[0];
+    return true;
+  }
+
+  // Error replies carry no data: status + PEC only.
+  uint8_t last = _wire->read();
+  uint8_t data_len = (buf[0] == STATUS_OK) ? len : 1;
+  uint8_t pec = (data_len < len) ? buf[data_len] : last;
+  uint8_t addr_r = (uint8_t)((_address << 1) | 1);
+  if (crc8(crc8(0, &addr_r, 1), buf, data_len) != pec || buf[0] == STATUS_PEC_ERR) {
+    _pec_errors++;
+    _io_error = true;
+    return false;
+  }
+  _last_status = buf[0];
   return true;
 }
 
@@ -57,6 +125,30 @@ bool SmartRelay::relayOff(uint8_t relay_id) {
   return status == STATUS_OK;
 }
 
+bool SmartRelay::relayOnForMs(uint8_t relay_id, uint16_t duration_ms) {
+  uint8_t payload[3] = { relay_id, (uint8_t)(duration_ms & 0xFF), (uint8_t)((duration_ms >> 8) & 0xFF) };
+  if (!sendCommand(CMD_RELAY_ON_FOR_MS, payload, sizeof(payload))) return false;
+  uint8_t status = STATUS_ERR;
+  if (!readStatus(status)) return false;
+  return status == STATUS_OK;
+}
+
+bool SmartRelay::relayOffForMs(uint8_t relay_id, uint16_t duration_ms) {
+  uint8_t payload[3] = { relay_id, (uint8_t)(duration_ms & 0xFF), (uint8_t)((duration_ms >> 8) & 0xFF) };
+  if (!sendCommand(CMD_RELAY_OFF_FOR_MS, payload, sizeof(payload))) return false;
+  uint8_t status = STATUS_ERR;
+  if (!readStatus(status)) return false;
+  return status == STATUS_OK;
+}
+
+bool SmartRelay::relaySetMask(uint8_t relay_mask, uint8_t state_mask) {
+  uint8_t payload[2] = { relay_mask, state_mask };
+  if (!sendCommand(CMD_RELAY_SET_MASK, payload, sizeof(payload))) return false;
+  uint8_t status = STATUS_ERR;
+  if (!readStatus(status)) return false;
+  return status == STATUS_OK;
+}
+
 bool SmartRelay::relayOnFor(uint8_t relay_id, uint16_t duration_sec) {
   uint8_t payload[3] = { relay_id, (uint8_t)(duration_sec & 0xFF), (uint8_t)((duration_sec >> 8) & 0xFF) };
   if (!sendCommand(CMD_RELAY_ON_FOR, payload, sizeof(payload))) return false;
@@ -95,6 +187,100 @@ bool SmartRelay::watchdogPing(void) {
   return status == STATUS_OK;
 }
 
+bool SmartRelay::groupSet(uint8_t group_mask) {
+  uint8_t payload[1] = { group_mask };
+  if (!sendCommand(CMD_GROUP_SET, payload, sizeof(payload))) return false;
+  uint8_t status = STATUS_ERR;
+  if (!readStatus(status)) return false;
+  return status == STATUS_OK;
+}
+
+bool SmartRelay::groupGet(uint8_t &out_group_mask, uint8_t &out_last_seq, uint8_t &out_last_status) {
+  if (!sendCommand(CMD_GROUP_GET, nullptr, 0)) return false;
+  uint8_t buf[4];
+  if (!readResponse(buf, sizeof(buf))) return false;
+  if (buf[0] != STATUS_OK) return false;
+  out_group_mask = buf[1];
+  out_last_seq = buf[2];
+  out_last_status = buf[3];
+  return true;
+}
+
+bool SmartRelay::groupRelaySet(TwoWire &wire, uint8_t group_mask, uint8_t relay_mask, uint8_t state_mask,
+                               uint8_t seq) {
+  // Broadcasts get no addressed reply, so they always carry a PEC.
+  uint8_t frame[6] = { CMD_GROUP_RELAY_SET, group_mask, relay_mask, state_mask, seq, 0 };
+  uint8_t addr_w = 0x00;
+  frame[5] = crc8(crc8(0, &addr_w, 1), frame, 5);
+  wire.beginTransmission((uint8_t)0x00);
+  wire.write(frame, sizeof(frame));
+  return wire.endTransmission() == 0;
+}
+
+bool SmartRelay::groupConfirm(uint8_t seq) {
+  uint8_t buf[3];
+  // ~seq keeps bus padding (0xFF) after a shorter reply from passing as seq.
+  if (readResponse(buf, sizeof(buf)) && buf[0] == STATUS_OK && buf[1] == seq && (uint8_t)(buf[1] ^ buf[2]) == 0xFF) {
+    return true;
+  }
+  uint8_t group_mask = 0;
+  uint8_t last_seq = 0;
+  uint8_t last_status = STATUS_ERR;
+  if (!groupGet(group_mask, last_seq, last_status)) return false;
+  _last_status = last_status;
+  return last_seq == seq && last_status == STATUS_OK;
+}
+
+uint8_t SmartRelay::groupConfirmAll(SmartRelay *const *relays, uint8_t count, uint8_t seq) {
+  uint8_t failed = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (!relays[i]->groupConfirm(seq)) {
+      failed++;
+    }
+  }
+  return failed;
+}
+
+bool SmartRelay::heartbeat(void) {
+  _hb_sent++;
+  _io_error = false;
+  _wire->beginTransmission(_address);
+  _wire->write(_hb_frame, _pec ? 2 : 1);
+  bool ok;
+  if (_wire->endTransmission() != 0) {
+    _hb_nacks++;
+    _hb_since_verify = 0;
+    ok = watchdogPing();
+  } else if (_hb_verify_every != 0 && ++_hb_since_verify >= _hb_verify_every) {
+    // A status left unread stays pending until the next command.
+    _hb_since_verify = 0;
+    uint8_t status = STATUS_ERR;
+    ok = readStatus(status) && status == STATUS_OK;
+  } else {
+    _hb_unverified++;
+    return true;
+  }
+  if (!ok) {
+    _hb_failures++;
+  }
+  return ok;
+}
+
+uint8_t SmartRelay::heartbeatAll(SmartRelay *const *relays, uint8_t count) {
+  uint8_t failed = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    SmartRelay *relay = relays[i];
+    if (relay->_hb_sent == 0 && relay->_hb_verify_every != 0) {
+      // Stagger verification so each batch reads back about count/N statuses.
+      relay->_hb_since_verify = (uint8_t)(i % relay->_hb_verify_every);
+    }
+    if (!relay->heartbeat()) {
+      failed++;
+    }
+  }
+  return failed;
+}
+
 bool SmartRelay::watchdogSetPingTimeout(uint16_t timeout_sec) {
   uint8_t payload[2] = { (uint8_t)(timeout_sec & 0xFF), (uint8_t)((timeout_sec >> 8) & 0xFF) };
   if (!sendCommand(CMD_WATCHDOG_SET_PING_TIMEOUT, payload, sizeof(payload))) return false;
@@ -288,3 +474,80 @@ bool SmartRelay::deviceInfo(uint16_t &out_vendor_id, uint16_t &out_product_id, u
   out_fw_version = (uint16_t)buf[6] | ((uint16_t)buf[7] << 8);
   return true;
 }
+
+bool SmartRelay::decodeStatus(const uint8_t *block, uint8_t len, SmartRelayStatus &out_status) {
+  if (block == nullptr || len < SMART_RELAY_STATUS_LEN || block[0] < SMART_RELAY_STATUS_VERSION ||
+      block[1] < SMART_RELAY_STATUS_LEN) {
+    return false;
+  }
+  out_status.version = block[0];
+  out_status.state_mask = block[2];
+  out_status.init_mask = block[3];
+  out_status.flags = block[4];
+  out_status.mode = block[5];
+  out_status.mode_relay = block[6];
+  out_status.shift_count = block[7];
+  out_status.trip_count = (uint32_t)block[8] |
+                          ((uint32_t)block[9] << 8) |
+                          ((uint32_t)block[10] << 16) |
+                          ((uint32_t)block[11] << 24);
+  out_status.eeprom_write_count = (uint32_t)block[12] |
+                                  ((uint32_t)block[13] << 8) |
+                                  ((uint32_t)block[14] << 16) |
+                                  ((uint32_t)block[15] << 24);
+  out_status.wd_remaining_sec = (uint16_t)block[16] | ((uint16_t)block[17] << 8);
+  out_status.pc_remaining_sec = (uint16_t)block[18] | ((uint16_t)block[19] << 8);
+  out_status.timer_mask = block[20];
+  out_status.next_timer_sec = (uint16_t)block[21] | ((uint16_t)block[22] << 8);
+  return true;
+}
+
+bool SmartRelay::getAllStatus(SmartRelayStatus &out_status) {
+  uint8_t payload[1] = { SMART_RELAY_STATUS_LEN };
+  if (!sendCommand(CMD_GET_ALL_STATUS, payload, sizeof(payload))) return false;
+  uint8_t buf[1 + SMART_RELAY_STATUS_LEN];
+  if (!readResponse(buf, sizeof(buf))) return false;
+  if (buf[0] != STATUS_OK) return false;
+  return decodeStatus(buf + 1, SMART_RELAY_STATUS_LEN, out_status);
+}
+
+bool SmartRelay::pecEnable(void) {
+  uint8_t payload[1] = { 1 };
+  if (!sendCommand(CMD_PEC_SET, payload, sizeof(payload))) return false;
+  // The reply is still framed in the mode the command was sent in.
+  uint8_t status = STATUS_ERR;
+  if (!readStatus(status)) return false;
+  if (status != STATUS_OK) return false;
+  _pec = true;
+  return true;
+}
+
+bool SmartRelay::pecDisable(void) {
+  uint8_t payload[1] = { 0 };
+  if (!sendCommand(CMD_PEC_SET, payload, sizeof(payload))) return false;
+  uint8_t status = STATUS_ERR;
+  if (!readStatus(status)) return false;
+  if (status != STATUS_OK) return false;
+  _pec = false;
+  return true;
+}
+
+bool SmartRelay::pecResync(void) {
+  if (!_pec) {
+    return false;
+  }
+  _pec = false;
+  uint8_t state_mask = 0;
+  uint8_t init_mask = 0;
+  if (!relayGetState(state_mask, init_mask)) {
+    // Still speaking PEC: the CRC failure was the bus, not a reset.
+    _pec = true;
+    return false;
+  }
+  if (!pecEnable()) {
+    // Keep PEC on for the host so a failed attempt can be repeated.
+    _pec = true;
+    return false;
+  }
+  return true;
+}
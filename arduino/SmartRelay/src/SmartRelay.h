@@ -37,7 +37,15 @@ enum {
   CMD_EEPROM_GET_SHIFT_COUNT = 0x19,
   CMD_FIRMWARE_GET_VERSION = 0x1A,
   CMD_EEPROM_GET_VERSION = 0x1B,
-  CMD_DEVICE_INFO = 0x1C
+  CMD_DEVICE_INFO = 0x1C,
+  CMD_PEC_SET = 0x1D,
+  CMD_GROUP_SET = 0x1E,
+  CMD_GROUP_GET = 0x1F,
+  CMD_GROUP_RELAY_SET = 0x20,  // general call only
+  CMD_GET_ALL_STATUS = 0x21,
+  CMD_RELAY_SET_MASK = 0x22,
+  CMD_RELAY_ON_FOR_MS = 0x23,
+  CMD_RELAY_OFF_FOR_MS = 0x24
 };
 
 // Status codes
@@ -46,7 +54,40 @@ enum {
   STATUS_ERR = 0x01,
   STATUS_BAD_CMD = 0x02,
   STATUS_BAD_PARAM = 0x03,
-  STATUS_BUSY = 0x04
+  STATUS_BUSY = 0x04,
+  STATUS_PEC_ERR = 0x05
+};
+
+enum SmartRelayMode {
+  SMART_RELAY_MODE_NONE = 0,
+  SMART_RELAY_MODE_WATCHDOG = 1,
+  SMART_RELAY_MODE_POWER_CYCLE = 2
+};
+
+// Get All Status block, version 1 (see docs/protocol.md)
+#define SMART_RELAY_STATUS_VERSION 1
+#define SMART_RELAY_STATUS_LEN 23
+
+#define SMART_RELAY_STATUS_RELAY_PERSIST   (1U << 0)
+#define SMART_RELAY_STATUS_RESET_ACTIVE_ON (1U << 1)
+#define SMART_RELAY_STATUS_WD_IN_RESET     (1U << 2)
+#define SMART_RELAY_STATUS_PC_OFF          (1U << 3)
+#define SMART_RELAY_STATUS_PC_SLEEP        (1U << 4)
+
+struct SmartRelayStatus {
+  uint8_t version;
+  uint8_t state_mask;
+  uint8_t init_mask;
+  uint8_t flags;  // SMART_RELAY_STATUS_* bits
+  uint8_t mode;   // SmartRelayMode
+  uint8_t mode_relay;
+  uint8_t shift_count;
+  uint32_t trip_count;
+  uint32_t eeprom_write_count;
+  uint16_t wd_remaining_sec;  // to the next trip, or to the end of the reset pulse
+  uint16_t pc_remaining_sec;  // to the forced sleep, or to power-on while off
+  uint8_t timer_mask;         // relays with a pending On/Off For revert
+  uint16_t next_timer_sec;    // soonest of those reverts
 };
 
 class SmartRelay {
@@ -59,6 +100,12 @@ public:
   bool relayOff(uint8_t relay_id);
   bool relayOnFor(uint8_t relay_id, uint16_t duration_sec);
   bool relayOffFor(uint8_t relay_id, uint16_t duration_sec);
+  // Millisecond pulses timed on the device; older firmware answers BAD_CMD.
+  bool relayOnForMs(uint8_t relay_id, uint16_t duration_ms);
+  bool relayOffForMs(uint8_t relay_id, uint16_t duration_ms);
+  // All relays in relay_mask to their bit in state_mask, one transaction.
+  // Older firmware answers BAD_CMD (lastStatus()).
+  bool relaySetMask(uint8_t relay_mask, uint8_t state_mask);
 
   bool watchdogEnable(uint8_t relay_id);
   bool watchdogDisable(void);
@@ -89,12 +136,68 @@ public:
   bool eepromGetVersion(uint8_t &out_version);
   bool deviceInfo(uint16_t &out_vendor_id, uint16_t &out_product_id, uint8_t &out_revision, uint16_t &out_fw_version);
 
+  // One round trip for the whole health picture. Returns false on firmware
+  // without the command (lastStatus() == STATUS_BAD_CMD).
+  bool getAllStatus(SmartRelayStatus &out_status);
+  static bool decodeStatus(const uint8_t *block, uint8_t len, SmartRelayStatus &out_status);
+
+  // Status byte of the last response received (STATUS_BUSY means retry).
+  uint8_t lastStatus(void) const { return _last_status; }
+  // True when the last command failed on the wire (NACK, short read, bad
+  // PEC) rather than with a status; see SmartRelayRecovery.
+  bool lastIoError(void) const { return _io_error; }
+
+  // Packet error checking (SMBus CRC-8). pecEnable() negotiates with the
+  // device; firmware without PEC answers BAD_CMD and framing stays plain.
+  bool pecEnable(void);
+  bool pecDisable(void);
+  bool pecEnabled(void) const { return _pec; }
+  // After a device reset PEC is off again and replies fail the CRC check;
+  // this probes with plain framing and renegotiates if the device answers.
+  bool pecResync(void);
+  uint16_t pecErrorCount(void) const { return _pec_errors; }
+
+  static uint8_t crc8(uint8_t crc, const uint8_t *data, uint8_t len);
+
+  // Broadcast groups. groupRelaySet() switches relays on every member of
+  // group_mask with one general-call frame; groupConfirm() reads the result
+  // each member left pending, falling back to groupGet() if it was replaced.
+  bool groupSet(uint8_t group_mask);
+  bool groupGet(uint8_t &out_group_mask, uint8_t &out_last_seq, uint8_t &out_last_status);
+  static bool groupRelaySet(TwoWire &wire, uint8_t group_mask, uint8_t relay_mask, uint8_t state_mask, uint8_t seq);
+  bool groupConfirm(uint8_t seq);
+  // Returns how many relays did not confirm seq.
+  static uint8_t groupConfirmAll(SmartRelay *const *relays, uint8_t count, uint8_t seq);
+
+  // Watchdog heartbeat fast path: a pre-encoded ping is written without
+  // reading the status back. The status is checked on every Nth heartbeat
+  // (0 = never) and after a NACK, where a full watchdogPing() is retried.
+  bool heartbeat(void);
+  void heartbeatVerifyEvery(uint8_t n) { _hb_verify_every = n; }
+  // Heartbeats every relay back-to-back; returns how many failed.
+  static uint8_t heartbeatAll(SmartRelay *const *relays, uint8_t count);
+  uint32_t heartbeatSent(void) const { return _hb_sent; }
+  uint32_t heartbeatUnverified(void) const { return _hb_unverified; }
+  uint16_t heartbeatNacks(void) const { return _hb_nacks; }
+  uint16_t heartbeatFailures(void) const { return _hb_failures; }
+
 private:
   bool sendCommand(uint8_t cmd, const uint8_t *payload, uint8_t payload_len);
   bool readStatus(uint8_t &status);
   bool readResponse(uint8_t *buf, uint8_t len);
 
   uint8_t _address;
+  uint8_t _last_status;
+  bool _io_error;
+  bool _pec;
+  uint16_t _pec_errors;
+  uint8_t _hb_frame[2];
+  uint8_t _hb_verify_every;
+  uint8_t _hb_since_verify;
+  uint32_t _hb_sent;
+  uint32_t _hb_unverified;
+  uint16_t _hb_nacks;
+  uint16_t _hb_failures;
   TwoWire *_wire;
 };
 
@@ -0,0 +1,154 @@
+#include "SmartRelayCaps.h"
+
+SmartRelayCaps::Entry SmartRelayCaps::_cache[SMART_RELAY_CAPS_CACHE_SIZE];
+uint8_t SmartRelayCaps::_next = 0;
+uint16_t SmartRelayCaps::_hits = 0;
+uint16_t SmartRelayCaps::_misses = 0;
+
+SmartRelayCaps::SmartRelayCaps(SmartRelay &relay)
+  : _relay(&relay), _known(false), _caps(0), _vendor_id(0), _product_id(0), _fw_version(0) {
+}
+
+// A clean answer tells whether the command exists: OK or BUSY means
+// supported, any other status (BAD_CMD) means not. A wire failure aborts.
+bool SmartRelayCaps::probe(bool ok, uint8_t cap) {
+  if (ok || (!_relay->lastIoError() && _relay->lastStatus() == STATUS_BUSY)) {
+    _caps |= cap;
+    return true;
+  }
+  return !_relay->lastIoError();
+}
+
+bool SmartRelayCaps::probeAll(void) {
+  _caps = 0;
+  if (_relay->pecEnabled()) {
+    _caps |= SMART_RELAY_CAP_PEC;
+  } else if (!probe(_relay->pecDisable(), SMART_RELAY_CAP_PEC)) {
+    // PEC Set 0 on a plain session changes nothing.
+    return false;
+  }
+  uint8_t group_mask, last_seq, last_status;
+  if (!probe(_relay->groupGet(group_mask, last_seq, last_status), SMART_RELAY_CAP_GROUPS)) return false;
+  SmartRelayStatus status;
+  if (!probe(_relay->getAllStatus(status), SMART_RELAY_CAP_ALL_STATUS)) return false;
+  // An empty relay_mask is a no-op.
+  if (!probe(_relay->relaySetMask(0, 0), SMART_RELAY_CAP_RELAY_MASK)) return false;
+  // A zero duration is rejected with BAD_PARAM by firmware that knows the command.
+  if (!_relay->relayOnForMs(0, 0)) {
+    // BUSY tells nothing here; fail rather than cache a guess.
+    if (_relay->lastIoError() || _relay->lastStatus() == STATUS_BUSY) return false;
+    if (_relay->lastStatus() == STATUS_BAD_PARAM) {
+      _caps |= SMART_RELAY_CAP_PULSE_MS;
+    }
+  }
+  return true;
+}
+
+bool SmartRelayCaps::query(uint8_t &out_caps) {
+  if (!_known) {
+    uint8_t revision = 0;
+    if (!_relay->deviceInfo(_vendor_id, _product_id, revision, _fw_version)) {
+      if (_relay->lastIoError() || _relay->lastStatus() == STATUS_BUSY) return false;
+      // Firmware older than Device Info: key on the version alone.
+      _vendor_id = 0;
+      _product_id = 0;
+      if (!_relay->firmwareGetVersion(_fw_version)) return false;
+    }
+
+    Entry *hit = nullptr;
+    for (uint8_t i = 0; i < SMART_RELAY_CAPS_CACHE_SIZE; i++) {
+      Entry &e = _cache[i];
+      if (e.valid && e.vendor_id == _vendor_id && e.product_id == _product_id && e.fw_version == _fw_version) {
+        hit = &e;
+        break;
+      }
+    }
+    if (hit != nullptr) {
+      _hits++;
+      _caps = hit->caps;
+    } else {
+      if (!probeAll()) return false;
+      _misses++;
+      Entry &e = _cache[_next];
+      _next = (uint8_t)((_next + 1) % SMART_RELAY_CAPS_CACHE_SIZE);
+      e.vendor_id = _vendor_id;
+      e.product_id = _product_id;
+      e.fw_version = _fw_version;
+      e.caps = _caps;
+      e.valid = true;
+    }
+    _known = true;
+  }
+  out_caps = _caps;
+  return true;
+}
+
+bool SmartRelayCaps::writeWithRetry(bool use_mask, uint8_t relay_mask, uint8_t state_mask) {
+  uint8_t relay_id = 0;
+  while (!use_mask && !(relay_mask & (1U << relay_id))) {
+    relay_id++;
+  }
+  for (uint8_t attempt = 0;; attempt++) {
+    bool ok;
+    if (use_mask) {
+      ok = _relay->relaySetMask(relay_mask, state_mask);
+    } else {
+      ok = (state_mask & relay_mask) ? _relay->relayOn(relay_id) : _relay->relayOff(relay_id);
+    }
+    if (ok || _relay->lastIoError() || _relay->lastStatus() != STATUS_BUSY ||
+        attempt >= SMART_RELAY_CAPS_BUSY_RETRIES) {
+      return ok;
+    }
+    delay((uint32_t)SMART_RELAY_CAPS_BUSY_DELAY_MS << attempt);
+  }
+}
+
+bool SmartRelayCaps::relaySetMask(uint8_t relay_mask, uint8_t state_mask) {
+  uint8_t caps = 0;
+  if (!query(caps)) return false;
+  if (caps & SMART_RELAY_CAP_RELAY_MASK) {
+    return writeWithRetry(true, relay_mask, state_mask);
+  }
+  for (uint8_t i = 0; i < 8; i++) {
+    uint8_t bit = (uint8_t)(1U << i);
+    if ((relay_mask & bit) && !writeWithRetry(false, bit, state_mask)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SmartRelayCaps::relayPulseMs(uint8_t relay_id, bool on, uint16_t duration_ms) {
+  uint8_t caps = 0;
+  if (!query(caps)) return false;
+  if (caps & SMART_RELAY_CAP_PULSE_MS) {
+    return on ? _relay->relayOnForMs(relay_id, duration_ms) : _relay->relayOffForMs(relay_id, duration_ms);
+  }
+  if (duration_ms % 1000 == 0) {
+    uint16_t sec = (uint16_t)(duration_ms / 1000);
+    return on ? _relay->relayOnFor(relay_id, sec) : _relay->relayOffFor(relay_id, sec);
+  }
+  if (!(on ? _relay->relayOn(relay_id) : _relay->relayOff(relay_id))) return false;
+  delay(duration_ms);
+  return on ? _relay->relayOff(relay_id) : _relay->relayOn(relay_id);
+}
+
+bool SmartRelayCaps::getStatus(SmartRelayStatus &out_status) {
+  uint8_t caps = 0;
+  if (!query(caps)) return false;
+  if (caps & SMART_RELAY_CAP_ALL_STATUS) {
+    return _relay->getAllStatus(out_status);
+  }
+  memset(&out_status, 0, sizeof(out_status));
+  bool persist = false;
+  uint8_t active_state = 0;
+  if (!_relay->relayGetState(out_status.state_mask, out_status.init_mask)) return false;
+  if (!_relay->relayStatePersistGet(persist)) return false;
+  if (!_relay->watchdogGetResetActiveState(active_state)) return false;
+  if (!_relay->watchdogGetTripCount(out_status.trip_count)) return false;
+  if (!_relay->eepromGetWriteCount(out_status.eeprom_write_count)) return false;
+  if (!_relay->eepromGetShiftCount(out_status.shift_count)) return false;
+  out_status.flags = (uint8_t)((persist ? SMART_RELAY_STATUS_RELAY_PERSIST : 0) |
+                               (active_state ? SMART_RELAY_STATUS_RESET_ACTIVE_ON : 0));
+  return true;
+}
@@ -0,0 +1,69 @@
+#ifndef SMART_RELAY_CAPS_ARDUINO_H
+#define SMART_RELAY_CAPS_ARDUINO_H
+
+#include <Arduino.h>
+#include "SmartRelay.h"
+
+// Capability negotiation. query() reads deviceInfo() once and looks the
+// vendor/product/firmware up in a cache shared by all SmartRelayCaps
+// objects; optional commands are only probed on a miss. The routed calls
+// use the fastest command the board has and fall back to the basic ones.
+
+#define SMART_RELAY_CAP_PEC        (1U << 0)
+#define SMART_RELAY_CAP_GROUPS     (1U << 1)
+#define SMART_RELAY_CAP_ALL_STATUS (1U << 2)
+#define SMART_RELAY_CAP_RELAY_MASK (1U << 3)
+#define SMART_RELAY_CAP_PULSE_MS   (1U << 4)
+
+#define SMART_RELAY_CAPS_CACHE_SIZE 4
+#define SMART_RELAY_CAPS_BUSY_RETRIES 3
+#define SMART_RELAY_CAPS_BUSY_DELAY_MS 5
+
+class SmartRelayCaps {
+public:
+  explicit SmartRelayCaps(SmartRelay &relay);
+
+  bool query(uint8_t &out_caps);
+  bool has(uint8_t cap) const { return _known && (_caps & cap) != 0; }
+  // Forgets this board's capabilities, e.g. after a firmware update.
+  void invalidate(void) { _known = false; }
+
+  // relaySetMask() where supported, otherwise relayOn()/relayOff() per relay.
+  bool relaySetMask(uint8_t relay_mask, uint8_t state_mask);
+  // relayOnForMs()/relayOffForMs() where supported, whole seconds through
+  // relayOnFor()/relayOffFor(), otherwise switched and timed with delay().
+  bool relayPulseMs(uint8_t relay_id, bool on, uint16_t duration_ms);
+  // getAllStatus() where supported, otherwise the individual reads; the
+  // fallback reports version 0 and leaves mode and timers zero.
+  bool getStatus(SmartRelayStatus &out_status);
+
+  static uint16_t cacheHits(void) { return _hits; }
+  static uint16_t cacheMisses(void) { return _misses; }
+
+private:
+  struct Entry {
+    uint16_t vendor_id;
+    uint16_t product_id;
+    uint16_t fw_version;
+    uint8_t caps;
+    bool valid;
+  };
+
+  bool probe(bool ok, uint8_t cap);
+  bool probeAll(void);
+  bool writeWithRetry(bool use_mask, uint8_t relay_mask, uint8_t state_mask);
+
+  SmartRelay *_relay;
+  bool _known;
+  uint8_t _caps;
+  uint16_t _vendor_id;
+  uint16_t _product_id;
+  uint16_t _fw_version;
+
+  static Entry _cache[SMART_RELAY_CAPS_CACHE_SIZE];
+  static uint8_t _next;
+  static uint16_t _hits;
+  static uint16_t _misses;
+};
+
+#endif // SMART_RELAY_CAPS_ARDUINO_H
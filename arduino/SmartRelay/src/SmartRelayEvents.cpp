@@ -0,0 +1,341 @@
+#include "SmartRelayEvents.h"
+
+static int32_t timeDiff(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b);
+}
+
+SmartRelayEvents::SmartRelayEvents(SmartRelay &relay)
+  : _relay(&relay),
+    _idle_ms(2000), _fast_ms(100), _guard_ms(500),
+    _primed(false), _state_mask(0), _init_mask(0), _trip_count(0), _next_poll_ms(0),
+    _timer_mask(0), _timer_revert_mask(0),
+    _wd_armed(false), _trip_known(false), _wd_relay(0), _wd_active_state(1), _wd_backoff(1),
+    _wd_timeout_ms(0), _wd_reset_ms(0), _wd_deadline_ms(0),
+    _pc_armed(false), _pc_pending(false), _pc_sleep_requested(false), _pc_relay(0),
+    _pc_max_on_ms(0), _pc_off_ms(0), _pc_deadline_ms(0),
+    _bus_reads(0) {
+  for (uint8_t i = 0; i < SMART_RELAY_EVENT_TYPE_COUNT; i++) {
+    _cb[i] = nullptr;
+    _cb_user[i] = nullptr;
+  }
+  for (uint8_t i = 0; i < SMART_RELAY_EVENTS_MAX_RELAYS; i++) {
+    _timer_deadline_ms[i] = 0;
+  }
+}
+
+void SmartRelayEvents::onRelayChange(Callback cb, void *user) {
+  _cb[SMART_RELAY_EVENT_RELAY_CHANGED] = cb;
+  _cb_user[SMART_RELAY_EVENT_RELAY_CHANGED] = user;
+}
+
+void SmartRelayEvents::onWatchdogTrip(Callback cb, void *user) {
+  _cb[SMART_RELAY_EVENT_WATCHDOG_TRIP] = cb;
+  _cb_user[SMART_RELAY_EVENT_WATCHDOG_TRIP] = user;
+}
+
+void SmartRelayEvents::onPowerCycle(Callback cb, void *user) {
+  _cb[SMART_RELAY_EVENT_POWER_CYCLE] = cb;
+  _cb_user[SMART_RELAY_EVENT_POWER_CYCLE] = user;
+}
+
+void SmartRelayEvents::setIntervals(uint16_t idle_ms, uint16_t fast_ms, uint16_t guard_ms) {
+  if (fast_ms == 0 || idle_ms < fast_ms) {
+    return;
+  }
+  _idle_ms = idle_ms;
+  _fast_ms = fast_ms;
+  _guard_ms = guard_ms;
+}
+
+bool SmartRelayEvents::nearDeadline(uint32_t deadline_ms, uint32_t now_ms) const {
+  int32_t dt = timeDiff(deadline_ms, now_ms);
+  return dt <= (int32_t)_guard_ms && dt >= -(int32_t)_guard_ms;
+}
+
+void SmartRelayEvents::emit(uint8_t type, uint8_t relay_id, uint8_t state, bool expected, uint32_t now_ms) {
+  if (_cb[type] == nullptr) {
+    return;
+  }
+  SmartRelayEvent event;
+  event.type = type;
+  event.relay_id = relay_id;
+  event.state = state;
+  event.expected = expected;
+  event.trip_count = _trip_count;
+  event.time_ms = now_ms;
+  _cb[type](*_relay, event, _cb_user[type]);
+}
+
+void SmartRelayEvents::noteCommanded(uint8_t relay_id, bool on) {
+  // Host-initiated changes are not reported back as events.
+  if (!_primed || relay_id >= SMART_RELAY_EVENTS_MAX_RELAYS) {
+    return;
+  }
+  uint8_t bit = (uint8_t)(1U << relay_id);
+  _init_mask |= bit;
+  if (on) {
+    _state_mask |= bit;
+  } else {
+    _state_mask &= (uint8_t)~bit;
+  }
+}
+
+void SmartRelayEvents::schedule(uint32_t now_ms) {
+  uint32_t next = now_ms + _idle_ms;
+  uint32_t deadlines[SMART_RELAY_EVENTS_MAX_RELAYS + 2];
+  uint8_t count = 0;
+
+  for (uint8_t i = 0; i < SMART_RELAY_EVENTS_MAX_RELAYS; i++) {
+    if (_timer_mask & (1U << i)) {
+      deadlines[count++] = _timer_deadline_ms[i];
+    }
+  }
+  if (_wd_armed) {
+    deadlines[count++] = _wd_deadline_ms;
+  }
+  if (_pc_armed && _pc_pending) {
+    deadlines[count++] = _pc_deadline_ms;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    int32_t dt = timeDiff(deadlines[i], now_ms);
+    uint32_t candidate;
+    if (dt < -(int32_t)_guard_ms) {
+      continue;
+    }
+    if (dt <= (int32_t)_guard_ms) {
+      candidate = now_ms + _fast_ms;
+    } else {
+      candidate = deadlines[i] - _guard_ms;
+    }
+    if (timeDiff(candidate, next) < 0) {
+      next = candidate;
+    }
+  }
+  _next_poll_ms = next;
+}
+
+void SmartRelayEvents::expectTimer(uint8_t relay_id, uint8_t revert_state, uint32_t duration_ms) {
+  if (relay_id >= SMART_RELAY_EVENTS_MAX_RELAYS) {
+    return;
+  }
+  uint32_t now_ms = millis();
+  uint8_t bit = (uint8_t)(1U << relay_id);
+  _timer_mask |= bit;
+  if (revert_state) {
+    _timer_revert_mask |= bit;
+  } else {
+    _timer_revert_mask &= (uint8_t)~bit;
+  }
+  _timer_deadline_ms[relay_id] = now_ms + duration_ms;
+  schedule(now_ms);
+}
+
+bool SmartRelayEvents::relayOnFor(uint8_t relay_id, uint16_t duration_sec) {
+  if (!_relay->relayOnFor(relay_id, duration_sec)) return false;
+  noteCommanded(relay_id, true);
+  expectTimer(relay_id, 0, (uint32_t)duration_sec * 1000UL);
+  return true;
+}
+
+bool SmartRelayEvents::relayOffFor(uint8_t relay_id, uint16_t duration_sec) {
+  if (!_relay->relayOffFor(relay_id, duration_sec)) return false;
+  noteCommanded(relay_id, false);
+  expectTimer(relay_id, 1, (uint32_t)duration_sec * 1000UL);
+  return true;
+}
+
+void SmartRelayEvents::watchWatchdog(uint8_t relay_id, uint16_t timeout_sec, uint16_t reset_sec, uint8_t active_state) {
+  if (relay_id >= SMART_RELAY_EVENTS_MAX_RELAYS) {
+    return;
+  }
+  _wd_armed = true;
+  _pc_armed = false;  // modes are exclusive on the device
+  _wd_relay = relay_id;
+  _wd_active_state = active_state ? 1 : 0;
+  _wd_timeout_ms = (uint32_t)timeout_sec * 1000UL;
+  _wd_reset_ms = (uint32_t)reset_sec * 1000UL;
+  _trip_known = false;
+  notePing();
+}
+
+void SmartRelayEvents::notePing(void) {
+  if (!_wd_armed) {
+    return;
+  }
+  uint32_t now_ms = millis();
+  _wd_backoff = 1;
+  _wd_deadline_ms = now_ms + _wd_timeout_ms;
+  schedule(now_ms);
+}
+
+bool SmartRelayEvents::watchdogPing(void) {
+  if (!_relay->watchdogPing()) return false;
+  notePing();
+  return true;
+}
+
+void SmartRelayEvents::watchPowerCycle(uint8_t relay_id, uint16_t max_on_sec) {
+  if (relay_id >= SMART_RELAY_EVENTS_MAX_RELAYS) {
+    return;
+  }
+  uint32_t now_ms = millis();
+  _pc_armed = true;
+  _wd_armed = false;
+  _pc_relay = relay_id;
+  _pc_max_on_ms = (uint32_t)max_on_sec * 1000UL;
+  _pc_pending = max_on_sec > 0;
+  _pc_deadline_ms = now_ms + _pc_max_on_ms;
+  _pc_sleep_requested = false;
+  schedule(now_ms);
+}
+
+void SmartRelayEvents::noteSleep(uint16_t off_sec) {
+  if (!_pc_armed) {
+    return;
+  }
+  uint32_t now_ms = millis();
+  _pc_off_ms = (uint32_t)off_sec * 1000UL;
+  _pc_sleep_requested = true;
+  _pc_pending = true;
+  _pc_deadline_ms = now_ms + _pc_off_ms;
+  // Catch the immediate OFF transition quickly.
+  _next_poll_ms = now_ms + _fast_ms;
+}
+
+bool SmartRelayEvents::powerCycleSleep(uint16_t off_sec) {
+  if (!_relay->powerCycleSleep(off_sec)) return false;
+  noteSleep(off_sec);
+  return true;
+}
+
+void SmartRelayEvents::unwatch(void) {
+  _wd_armed = false;
+  _pc_armed = false;
+  _pc_pending = false;
+  _timer_mask = 0;
+}
+
+void SmartRelayEvents::checkTrips(uint32_t now_ms) {
+  uint32_t count = 0;
+  _bus_reads++;
+  if (!_relay->watchdogGetTripCount(count)) return;
+
+  if (!_trip_known) {
+    _trip_known = true;
+    _trip_count = count;
+    return;
+  }
+
+  if (count != _trip_count && !_wd_armed) {
+    // No watchdog model to check the trip against.
+    _trip_count = count;
+    emit(SMART_RELAY_EVENT_WATCHDOG_TRIP, _wd_relay, _wd_active_state, false, now_ms);
+  } else if (count != _trip_count) {
+    bool expected = timeDiff(now_ms, _wd_deadline_ms) >= -(int32_t)_guard_ms;
+    _trip_count = count;
+    if (_wd_backoff < SMART_RELAY_EVENTS_WD_MAX_BACKOFF) {
+      _wd_backoff = (uint8_t)(_wd_backoff * 2);
+    }
+    // The ping timeout restarts once the reset pulse has finished.
+    _wd_deadline_ms = now_ms + _wd_reset_ms + _wd_timeout_ms * _wd_backoff;
+    bool on = ((_state_mask >> _wd_relay) & 1U) != 0;
+    if (on == (_wd_active_state != 0)) {
+      expectTimer(_wd_relay, on ? 0 : 1, _wd_reset_ms);
+    }
+    emit(SMART_RELAY_EVENT_WATCHDOG_TRIP, _wd_relay, _wd_active_state, expected, now_ms);
+  } else if (timeDiff(now_ms, _wd_deadline_ms) > (int32_t)_guard_ms) {
+    // No trip past the deadline: someone else is pinging. Restart the estimate.
+    _wd_backoff = 1;
+    _wd_deadline_ms = now_ms + _wd_timeout_ms;
+  }
+}
+
+uint32_t SmartRelayEvents::update(void) {
+  uint32_t now_ms = millis();
+  if (_primed && timeDiff(now_ms, _next_poll_ms) < 0) {
+    return _next_poll_ms - now_ms;
+  }
+
+  uint8_t state_mask = 0;
+  uint8_t init_mask = 0;
+  _bus_reads++;
+  if (!_relay->relayGetState(state_mask, init_mask)) {
+    _next_poll_ms = now_ms + _fast_ms;
+    return _fast_ms;
+  }
+
+  bool need_trips = _wd_armed && !_trip_known;
+
+  if (_primed) {
+    uint8_t changed = (uint8_t)((state_mask ^ _state_mask) & init_mask & _init_mask);
+    for (uint8_t i = 0; i < SMART_RELAY_EVENTS_MAX_RELAYS; i++) {
+      uint8_t bit = (uint8_t)(1U << i);
+      if (!(changed & bit)) {
+        continue;
+      }
+      uint8_t on = (state_mask & bit) ? 1 : 0;
+      bool expected = false;
+
+      if (_timer_mask & bit) {
+        uint8_t revert = (_timer_revert_mask & bit) ? 1 : 0;
+        expected = on == revert && nearDeadline(_timer_deadline_ms[i], now_ms);
+        _timer_mask &= (uint8_t)~bit;
+      }
+
+      if (_wd_armed && i == _wd_relay) {
+        need_trips = true;
+        if (on == _wd_active_state && timeDiff(now_ms, _wd_deadline_ms) >= -(int32_t)_guard_ms) {
+          expected = true;
+        }
+      }
+
+      if (_pc_armed && i == _pc_relay) {
+        bool requested = !on && _pc_sleep_requested;
+        bool pc_expected = requested || (_pc_pending && nearDeadline(_pc_deadline_ms, now_ms));
+        if (on) {
+          _pc_pending = _pc_max_on_ms > 0;
+          _pc_deadline_ms = now_ms + _pc_max_on_ms;
+        } else if (requested) {
+          // Wake-up deadline was recorded by noteSleep().
+          _pc_sleep_requested = false;
+        } else {
+          // Fallback sleep reuses the last configured off duration.
+          _pc_pending = _pc_off_ms > 0;
+          _pc_deadline_ms = now_ms + _pc_off_ms;
+        }
+        emit(SMART_RELAY_EVENT_POWER_CYCLE, i, on, pc_expected, now_ms);
+        expected = pc_expected;
+      }
+
+      emit(SMART_RELAY_EVENT_RELAY_CHANGED, i, on, expected, now_ms);
+    }
+
+    // Drop timer expectations that were cancelled or missed.
+    for (uint8_t i = 0; i < SMART_RELAY_EVENTS_MAX_RELAYS; i++) {
+      if ((_timer_mask & (1U << i)) && timeDiff(now_ms, _timer_deadline_ms[i]) > (int32_t)_guard_ms) {
+        _timer_mask &= (uint8_t)~(1U << i);
+      }
+    }
+    if (_pc_armed && _pc_pending && timeDiff(now_ms, _pc_deadline_ms) > (int32_t)_guard_ms) {
+      _pc_pending = false;
+    }
+  }
+
+  _state_mask = state_mask;
+  _init_mask = init_mask;
+  _primed = true;
+
+  if (_wd_armed && timeDiff(now_ms, _wd_deadline_ms) > (int32_t)_guard_ms) {
+    need_trips = true;
+  }
+  if (!_wd_armed && _cb[SMART_RELAY_EVENT_WATCHDOG_TRIP] != nullptr) {
+    need_trips = true;
+  }
+  if (need_trips) {
+    checkTrips(now_ms);
+  }
+
+  schedule(now_ms);
+  return _next_poll_ms - now_ms;
+}
@@ -0,0 +1,108 @@
+#ifndef SMART_RELAY_EVENTS_ARDUINO_H
+#define SMART_RELAY_EVENTS_ARDUINO_H
+
+#include <Arduino.h>
+#include "SmartRelay.h"
+
+// Change notifications built on top of relayGetState() / watchdogGetTripCount().
+// Call update() from loop(); the bus is only touched when the adaptive poll
+// interval has elapsed.
+
+#define SMART_RELAY_EVENTS_MAX_RELAYS 8
+#define SMART_RELAY_EVENTS_WD_MAX_BACKOFF 64
+
+enum SmartRelayEventType {
+  SMART_RELAY_EVENT_RELAY_CHANGED = 0,
+  SMART_RELAY_EVENT_WATCHDOG_TRIP = 1,
+  SMART_RELAY_EVENT_POWER_CYCLE = 2,
+  SMART_RELAY_EVENT_TYPE_COUNT = 3
+};
+
+struct SmartRelayEvent {
+  uint8_t type;
+  uint8_t relay_id;
+  uint8_t state;        // RELAY_CHANGED: 1=ON; POWER_CYCLE: 1=powered, 0=off
+  bool expected;        // true if the change matched a known deadline
+  uint32_t trip_count;  // WATCHDOG_TRIP: new trip counter value
+  uint32_t time_ms;     // millis() when the change was observed
+};
+
+class SmartRelayEvents {
+public:
+  typedef void (*Callback)(SmartRelay &relay, const SmartRelayEvent &event, void *user);
+
+  explicit SmartRelayEvents(SmartRelay &relay);
+
+  void onRelayChange(Callback cb, void *user = nullptr);
+  // Also works without watchWatchdog(): the trip counter is then read on
+  // every update and trips are reported as unexpected.
+  void onWatchdogTrip(Callback cb, void *user = nullptr);
+  void onPowerCycle(Callback cb, void *user = nullptr);
+  void setIntervals(uint16_t idle_ms, uint16_t fast_ms, uint16_t guard_ms);
+
+  // Deadline hints. The command wrappers issue the command and record the hint.
+  void expectTimer(uint8_t relay_id, uint8_t revert_state, uint32_t duration_ms);
+  bool relayOnFor(uint8_t relay_id, uint16_t duration_sec);
+  bool relayOffFor(uint8_t relay_id, uint16_t duration_sec);
+
+  void watchWatchdog(uint8_t relay_id, uint16_t timeout_sec, uint16_t reset_sec, uint8_t active_state = 1);
+  void notePing(void);
+  bool watchdogPing(void);
+
+  void watchPowerCycle(uint8_t relay_id, uint16_t max_on_sec);
+  void noteSleep(uint16_t off_sec);
+  bool powerCycleSleep(uint16_t off_sec);
+
+  void unwatch(void);
+
+  // Polls the device if due and returns the delay (ms) until the next poll.
+  uint32_t update(void);
+
+  uint32_t busReads(void) const { return _bus_reads; }
+
+private:
+  bool nearDeadline(uint32_t deadline_ms, uint32_t now_ms) const;
+  void emit(uint8_t type, uint8_t relay_id, uint8_t state, bool expected, uint32_t now_ms);
+  void noteCommanded(uint8_t relay_id, bool on);
+  void schedule(uint32_t now_ms);
+  void checkTrips(uint32_t now_ms);
+
+  SmartRelay *_relay;
+  Callback _cb[SMART_RELAY_EVENT_TYPE_COUNT];
+  void *_cb_user[SMART_RELAY_EVENT_TYPE_COUNT];
+
+  uint16_t _idle_ms;
+  uint16_t _fast_ms;
+  uint16_t _guard_ms;
+
+  bool _primed;
+  uint8_t _state_mask;
+  uint8_t _init_mask;
+  uint32_t _trip_count;
+  uint32_t _next_poll_ms;
+
+  uint8_t _timer_mask;
+  uint8_t _timer_revert_mask;
+  uint32_t _timer_deadline_ms[SMART_RELAY_EVENTS_MAX_RELAYS];
+
+  bool _wd_armed;
+  bool _trip_known;
+  uint8_t _wd_relay;
+  uint8_t _wd_active_state;
+  uint8_t _wd_backoff;
+  uint32_t _wd_timeout_ms;
+  uint32_t _wd_reset_ms;
+  uint32_t _wd_deadline_ms;
+
+  bool _pc_armed;
+  bool _pc_pending;
+  bool _pc_sleep_requested;
+  uint8_t _pc_relay;
+  uint32_t _pc_max_on_ms;
+  uint32_t _pc_off_ms;
+  uint32_t _pc_deadline_ms;
+
+  uint32_t _bus_reads;
+};
+
+#endif // SMART_RELAY_EVENTS_ARDUINO_H
@@ -0,0 +1,248 @@
+#include "SmartRelayProfile.h"
+
+SmartRelayProfile::SmartRelayProfile()
+  : fields(0), mode(SMART_RELAY_MODE_NONE), mode_relay(0), pc_sleep_enable(false),
+    wd_reset_active_state(1), relay_persist(false),
+    wd_ping_timeout_sec(0), wd_reset_duration_sec(0), pc_max_on_sec(0) {}
+
+void SmartRelayProfile::setWatchdog(uint8_t relay_id, uint16_t ping_timeout_sec, uint16_t reset_duration_sec,
+                                    uint8_t reset_active_state) {
+  fields |= SMART_RELAY_PROFILE_MODE | SMART_RELAY_PROFILE_WD_PING_TIMEOUT |
+            SMART_RELAY_PROFILE_WD_RESET_DURATION | SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE;
+  mode = SMART_RELAY_MODE_WATCHDOG;
+  mode_relay = relay_id;
+  pc_sleep_enable = false;
+  wd_ping_timeout_sec = ping_timeout_sec;
+  wd_reset_duration_sec = reset_duration_sec;
+  wd_reset_active_state = reset_active_state ? 1 : 0;
+}
+
+void SmartRelayProfile::setPowerCycle(uint8_t relay_id, uint16_t max_on_sec, bool sleep_enable) {
+  fields |= SMART_RELAY_PROFILE_MODE | SMART_RELAY_PROFILE_PC_MAX_ON_TIME;
+  mode = SMART_RELAY_MODE_POWER_CYCLE;
+  mode_relay = relay_id;
+  pc_sleep_enable = sleep_enable;
+  pc_max_on_sec = max_on_sec;
+}
+
+void SmartRelayProfile::setNoMode(void) {
+  fields |= SMART_RELAY_PROFILE_MODE;
+  mode = SMART_RELAY_MODE_NONE;
+}
+
+void SmartRelayProfile::setRelayPersist(bool enabled) {
+  fields |= SMART_RELAY_PROFILE_RELAY_PERSIST;
+  relay_persist = enabled;
+}
+
+bool SmartRelayProfile::knownMatches(const SmartRelayProfile *known, uint16_t field) const {
+  if (known == nullptr || !(known->fields & field)) {
+    return false;
+  }
+  switch (field) {
+    case SMART_RELAY_PROFILE_MODE:
+      if (known->mode != mode) return false;
+      if (mode == SMART_RELAY_MODE_NONE) return true;
+      if (known->mode_relay != mode_relay) return false;
+      return mode != SMART_RELAY_MODE_POWER_CYCLE || known->pc_sleep_enable == pc_sleep_enable;
+    case SMART_RELAY_PROFILE_WD_PING_TIMEOUT:
+      return known->wd_ping_timeout_sec == wd_ping_timeout_sec;
+    case SMART_RELAY_PROFILE_WD_RESET_DURATION:
+      return known->wd_reset_duration_sec == wd_reset_duration_sec;
+    case SMART_RELAY_PROFILE_PC_MAX_ON_TIME:
+      return known->pc_max_on_sec == pc_max_on_sec;
+    default:
+      return false;
+  }
+}
+
+bool SmartRelayProfile::readField(SmartRelay &relay, uint16_t field, uint8_t &out_value, SmartRelayProfileReport &report) const {
+  report.reads++;
+  if (field == SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE) {
+    return relay.watchdogGetResetActiveState(out_value);
+  }
+  bool enabled = false;
+  if (!relay.relayStatePersistGet(enabled)) return false;
+  out_value = enabled ? 1 : 0;
+  return true;
+}
+
+uint8_t SmartRelayProfile::desiredReadable(uint16_t field) const {
+  return field == SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE ? wd_reset_active_state : (relay_persist ? 1 : 0);
+}
+
+// Parameters of each mode
+#define PROFILE_WD_PARAMS (SMART_RELAY_PROFILE_WD_PING_TIMEOUT | SMART_RELAY_PROFILE_WD_RESET_DURATION | \
+                           SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE)
+#define PROFILE_PC_PARAMS SMART_RELAY_PROFILE_PC_MAX_ON_TIME
+
+// Internal step: leave the running mode before its parameters change.
+#define PROFILE_LEAVE (1U << 15)
+
+// Mode running on the device: from known if it has one, else from Get All
+// Status. 0xFF if neither can tell.
+uint8_t SmartRelayProfile::runningMode(SmartRelay &relay, const SmartRelayProfile *known,
+                                       SmartRelayProfileReport &report) const {
+  if (known != nullptr && (known->fields & SMART_RELAY_PROFILE_MODE)) {
+    return known->mode;
+  }
+  SmartRelayStatus status;
+  report.reads++;
+  if (!relay.getAllStatus(status)) {
+    return 0xFF;
+  }
+  return status.mode;
+}
+
+// Counts a write the device acknowledged; BUSY retries are not counted.
+static bool acked(SmartRelayProfileReport &report, bool ok) {
+  if (ok) {
+    report.writes++;
+  }
+  return ok;
+}
+
+// running is the mode on the device, 0xFF if unknown (disable both).
+bool SmartRelayProfile::disableMode(SmartRelay &relay, uint8_t running, SmartRelayProfileReport &report) const {
+  if (running == SMART_RELAY_MODE_WATCHDOG || running == 0xFF) {
+    if (!acked(report, relay.watchdogDisable())) return false;
+  }
+  if (running == SMART_RELAY_MODE_POWER_CYCLE || running == 0xFF) {
+    if (!acked(report, relay.powerCycleDisable())) return false;
+  }
+  return true;
+}
+
+bool SmartRelayProfile::writeField(SmartRelay &relay, uint8_t running, uint16_t field,
+                                   SmartRelayProfileReport &report) const {
+  switch (field) {
+    case PROFILE_LEAVE:
+      return disableMode(relay, running, report);
+    case SMART_RELAY_PROFILE_MODE:
+      if (mode == SMART_RELAY_MODE_WATCHDOG) {
+        return acked(report, relay.watchdogEnable(mode_relay));
+      }
+      if (mode == SMART_RELAY_MODE_POWER_CYCLE) {
+        return acked(report, relay.powerCycleEnable(mode_relay, pc_sleep_enable));
+      }
+      return disableMode(relay, running, report);
+    case SMART_RELAY_PROFILE_WD_PING_TIMEOUT:
+      return acked(report, relay.watchdogSetPingTimeout(wd_ping_timeout_sec));
+    case SMART_RELAY_PROFILE_WD_RESET_DURATION:
+      return acked(report, relay.watchdogSetResetDuration(wd_reset_duration_sec));
+    case SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE:
+      return acked(report, relay.watchdogSetResetActiveState(wd_reset_active_state));
+    case SMART_RELAY_PROFILE_PC_MAX_ON_TIME:
+      return acked(report, relay.powerCycleSetMaxOnTime(pc_max_on_sec));
+    case SMART_RELAY_PROFILE_RELAY_PERSIST:
+      return acked(report, relay_persist ? relay.relayStatePersistEnable() : relay.relayStatePersistDisable());
+    default:
+      return false;
+  }
+}
+
+bool SmartRelayProfile::writeWithRetry(SmartRelay &relay, uint8_t running, uint16_t field,
+                                       SmartRelayProfileReport &report) const {
+  bool ok = writeField(relay, running, field, report);
+  for (uint8_t attempt = 0;
+       !ok && !relay.lastIoError() && relay.lastStatus() == STATUS_BUSY && attempt < SMART_RELAY_PROFILE_BUSY_RETRIES;
+       attempt++) {
+    delay((unsigned long)SMART_RELAY_PROFILE_BUSY_DELAY_MS << attempt);
+    ok = writeField(relay, running, field, report);
+  }
+  return ok;
+}
+
+bool SmartRelayProfile::apply(SmartRelay &relay, const SmartRelayProfile *known, SmartRelayProfileReport *report) const {
+  SmartRelayProfileReport local;
+  if (report == nullptr) {
+    report = &local;
+  }
+  *report = SmartRelayProfileReport();
+
+  static const uint16_t readable[] = {
+    SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE,
+    SMART_RELAY_PROFILE_RELAY_PERSIST
+  };
+  uint16_t todo = fields;
+
+  // Diff: read back what the protocol exposes, trust known for the rest.
+  for (uint8_t i = 0; i < sizeof(readable) / sizeof(readable[0]); i++) {
+    uint16_t field = readable[i];
+    uint8_t value = 0;
+    if ((todo & field) && readField(relay, field, value, *report) && value == desiredReadable(field)) {
+      todo &= (uint16_t)~field;
+      report->skipped |= field;
+    }
+  }
+  for (uint16_t field = SMART_RELAY_PROFILE_MODE; field <= SMART_RELAY_PROFILE_PC_MAX_ON_TIME; field <<= 1) {
+    if ((todo & field) && knownMatches(known, field)) {
+      todo &= (uint16_t)~field;
+      report->skipped |= field;
+    }
+  }
+
+  // Safe order: leave the running mode before touching its parameters, and
+  // enter a mode only after its parameters are in place.
+  uint8_t running = 0xFF;
+  if (todo & (SMART_RELAY_PROFILE_MODE | PROFILE_WD_PARAMS | PROFILE_PC_PARAMS)) {
+    running = runningMode(relay, known, *report);
+  }
+  if ((todo & SMART_RELAY_PROFILE_MODE) && mode == SMART_RELAY_MODE_NONE && running == SMART_RELAY_MODE_NONE) {
+    todo &= (uint16_t)~SMART_RELAY_PROFILE_MODE;
+    report->skipped |= SMART_RELAY_PROFILE_MODE;
+  }
+  uint16_t leave_first = 0;
+  if ((todo & SMART_RELAY_PROFILE_MODE) && mode == SMART_RELAY_MODE_NONE) {
+    leave_first = SMART_RELAY_PROFILE_MODE;
+  } else if ((fields & SMART_RELAY_PROFILE_MODE) &&
+             (((todo & PROFILE_WD_PARAMS) && (running == SMART_RELAY_MODE_WATCHDOG || running == 0xFF)) ||
+              ((todo & PROFILE_PC_PARAMS) && (running == SMART_RELAY_MODE_POWER_CYCLE || running == 0xFF)))) {
+    // Only with a mode in the profile: the mode is entered again at the end.
+    leave_first = PROFILE_LEAVE;
+    todo |= PROFILE_LEAVE;
+    if (mode != SMART_RELAY_MODE_NONE) {
+      todo |= SMART_RELAY_PROFILE_MODE;
+      report->skipped &= (uint16_t)~SMART_RELAY_PROFILE_MODE;
+    }
+  }
+
+  uint16_t order[7];
+  uint8_t count = 0;
+  if (leave_first) order[count++] = leave_first;
+  order[count++] = SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE;
+  order[count++] = SMART_RELAY_PROFILE_WD_PING_TIMEOUT;
+  order[count++] = SMART_RELAY_PROFILE_WD_RESET_DURATION;
+  order[count++] = SMART_RELAY_PROFILE_PC_MAX_ON_TIME;
+  order[count++] = SMART_RELAY_PROFILE_RELAY_PERSIST;
+  if (leave_first != SMART_RELAY_PROFILE_MODE) order[count++] = SMART_RELAY_PROFILE_MODE;
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint16_t field = order[i];
+    if (!(todo & field)) {
+      continue;
+    }
+    if (!writeWithRetry(relay, running, field, *report)) {
+      // Stop here so a mode is never entered with stale parameters.
+      report->failed |= field == PROFILE_LEAVE ? SMART_RELAY_PROFILE_MODE : field;
+      return false;
+    }
+    if (field != PROFILE_LEAVE) {
+      report->written |= field;
+    }
+  }
+
+  bool ok = true;
+  for (uint8_t i = 0; i < sizeof(readable) / sizeof(readable[0]); i++) {
+    uint16_t field = readable[i];
+    uint8_t value = 0;
+    if (!(report->written & field)) {
+      continue;
+    }
+    if (!readField(relay, field, value, *report) || value != desiredReadable(field)) {
+      report->failed |= field;
+      ok = false;
+    }
+  }
+  return ok;
+}
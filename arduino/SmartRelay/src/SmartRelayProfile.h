@@ -0,0 +1,62 @@
+#ifndef SMART_RELAY_PROFILE_ARDUINO_H
+#define SMART_RELAY_PROFILE_ARDUINO_H
+
+#include <Arduino.h>
+#include "SmartRelay.h"
+
+// Declarative configuration profiles. apply() reads back what the protocol
+// allows, skips fields that already match, writes the rest in a mode-safe
+// order and verifies the result.
+
+#define SMART_RELAY_PROFILE_MODE                  (1U << 0)
+#define SMART_RELAY_PROFILE_WD_PING_TIMEOUT       (1U << 1)
+#define SMART_RELAY_PROFILE_WD_RESET_DURATION     (1U << 2)
+#define SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE (1U << 3)
+#define SMART_RELAY_PROFILE_PC_MAX_ON_TIME        (1U << 4)
+#define SMART_RELAY_PROFILE_RELAY_PERSIST         (1U << 5)
+
+#define SMART_RELAY_PROFILE_BUSY_RETRIES 3
+#define SMART_RELAY_PROFILE_BUSY_DELAY_MS 20
+
+struct SmartRelayProfileReport {
+  uint16_t written;   // fields written to the device
+  uint16_t skipped;   // fields already matching
+  uint16_t failed;    // fields whose write or verify failed
+  uint8_t writes;     // writes the device acknowledged (EEPROM writes)
+  uint8_t reads;      // readback transactions issued
+};
+
+class SmartRelayProfile {
+public:
+  SmartRelayProfile();
+
+  void setWatchdog(uint8_t relay_id, uint16_t ping_timeout_sec, uint16_t reset_duration_sec, uint8_t reset_active_state = 1);
+  void setPowerCycle(uint8_t relay_id, uint16_t max_on_sec, bool sleep_enable = false);
+  void setNoMode(void);
+  void setRelayPersist(bool enabled);
+
+  // Write-only fields (mode, timeouts, max on time) are compared against
+  // known, the last profile applied to this device, if given.
+  bool apply(SmartRelay &relay, const SmartRelayProfile *known = nullptr, SmartRelayProfileReport *report = nullptr) const;
+
+  uint16_t fields;
+  uint8_t mode;
+  uint8_t mode_relay;
+  bool pc_sleep_enable;
+  uint8_t wd_reset_active_state;
+  bool relay_persist;
+  uint16_t wd_ping_timeout_sec;
+  uint16_t wd_reset_duration_sec;
+  uint16_t pc_max_on_sec;
+
+private:
+  bool knownMatches(const SmartRelayProfile *known, uint16_t field) const;
+  bool readField(SmartRelay &relay, uint16_t field, uint8_t &out_value, SmartRelayProfileReport &report) const;
+  uint8_t desiredReadable(uint16_t field) const;
+  uint8_t runningMode(SmartRelay &relay, const SmartRelayProfile *known, SmartRelayProfileReport &report) const;
+  bool disableMode(SmartRelay &relay, uint8_t running, SmartRelayProfileReport &report) const;
+  bool writeField(SmartRelay &relay, uint8_t running, uint16_t field, SmartRelayProfileReport &report) const;
+  bool writeWithRetry(SmartRelay &relay, uint8_t running, uint16_t field, SmartRelayProfileReport &report) const;
+};
+
+#endif // SMART_RELAY_PROFILE_ARDUINO_H
@@ -0,0 +1,193 @@
+#include "SmartRelayRecovery.h"
+
+SmartRelayRecovery::SmartRelayRecovery(TwoWire &wire, uint32_t clock_hz)
+  : _wire(&wire), _clock_hz(clock_hz), _sda_pin(0), _scl_pin(0), _pins_set(false), _clock_out(nullptr),
+    _bus_reset(nullptr), _max_attempts(SMART_RELAY_RECOVERY_ATTEMPTS), _max_retries(SMART_RELAY_RECOVERY_RETRIES),
+    _interrupted(0), _recoveries(0), _failures(0), _clock_outs(0), _bus_resets(0), _resyncs(0), _applied(0),
+    _retried(0), _last_us(0), _max_us(0) {
+}
+
+void SmartRelayRecovery::setPins(uint8_t sda_pin, uint8_t scl_pin) {
+  _sda_pin = sda_pin;
+  _scl_pin = scl_pin;
+  _pins_set = true;
+}
+
+void SmartRelayRecovery::setHooks(ClockOutHook clock_out, BusResetHook bus_reset) {
+  _clock_out = clock_out;
+  _bus_reset = bus_reset;
+}
+
+void SmartRelayRecovery::setAttempts(uint8_t max_attempts, uint8_t max_retries) {
+  _max_attempts = max_attempts;
+  _max_retries = max_retries;
+}
+
+bool SmartRelayRecovery::clockOut(uint8_t sda_pin, uint8_t scl_pin) {
+  // 5 us half periods: 100 kHz, slow enough for any slave on the bus.
+  pinMode(sda_pin, INPUT_PULLUP);
+  pinMode(scl_pin, OUTPUT);
+  for (uint8_t i = 0; i < 9 && digitalRead(sda_pin) == LOW; i++) {
+    digitalWrite(scl_pin, LOW);
+    delayMicroseconds(5);
+    digitalWrite(scl_pin, HIGH);
+    delayMicroseconds(5);
+  }
+  // STOP: SDA rises while SCL is high.
+  pinMode(sda_pin, OUTPUT);
+  digitalWrite(sda_pin, LOW);
+  delayMicroseconds(5);
+  digitalWrite(scl_pin, HIGH);
+  delayMicroseconds(5);
+  pinMode(sda_pin, INPUT_PULLUP);
+  delayMicroseconds(5);
+  bool released = digitalRead(sda_pin) == HIGH;
+  pinMode(scl_pin, INPUT_PULLUP);
+  return released;
+}
+
+void SmartRelayRecovery::clockOutBus(void) {
+  if (_clock_out != nullptr) {
+    _clock_outs++;
+    _clock_out();
+  } else if (_pins_set) {
+    _clock_outs++;
+    _wire->end();
+    clockOut(_sda_pin, _scl_pin);
+    _wire->begin();
+    if (_clock_hz > 0) {
+      _wire->setClock(_clock_hz);
+    }
+  }
+}
+
+void SmartRelayRecovery::resetBus(void) {
+  _bus_resets++;
+  if (_bus_reset != nullptr) {
+    _bus_reset();
+    return;
+  }
+  _wire->end();
+  _wire->begin();
+  if (_clock_hz > 0) {
+    _wire->setClock(_clock_hz);
+  }
+}
+
+bool SmartRelayRecovery::probe(SmartRelay &relay, uint8_t &state_mask, uint8_t &init_mask, bool &io_error,
+                               uint8_t &status) {
+  bool ok = relay.relayGetState(state_mask, init_mask);
+  io_error = relay.lastIoError();
+  status = relay.lastStatus();
+  // A device that reset answers plain frames, which fail the PEC check.
+  if (!ok && io_error && relay.pecEnabled() && relay.pecResync()) {
+    _resyncs++;
+    ok = relay.relayGetState(state_mask, init_mask);
+    io_error = relay.lastIoError();
+    status = relay.lastStatus();
+  }
+  return ok;
+}
+
+bool SmartRelayRecovery::recover(SmartRelay &relay, uint8_t &out_state_mask, uint8_t &out_init_mask) {
+  uint32_t start = micros();
+  uint16_t backoff_ms = 1;
+  bool ok = false;
+
+  for (uint8_t attempt = 0; attempt < _max_attempts && !ok; attempt++) {
+    // Stuck SDA first (cheap), then the adapter, then wait out a NACK storm.
+    if (attempt == 0) {
+      clockOutBus();
+    } else if (attempt == 1) {
+      resetBus();
+      clockOutBus();
+    } else {
+      delay(backoff_ms);
+      if (backoff_ms < SMART_RELAY_RECOVERY_BACKOFF_MAX_MS) {
+        backoff_ms = (uint16_t)(backoff_ms * 2);
+      }
+    }
+    // Classify by the probe's own answer: a failed transfer leaves
+    // lastStatus() from an earlier command.
+    bool io_error = false;
+    uint8_t status = STATUS_OK;
+    ok = probe(relay, out_state_mask, out_init_mask, io_error, status);
+    if (!ok && !io_error && status != STATUS_BUSY) {
+      break;  // a clean error answer: the bus works, the request does not
+    }
+  }
+
+  if (!ok) {
+    _failures++;
+    return false;
+  }
+  uint32_t elapsed = micros() - start;
+  _recoveries++;
+  _last_us = elapsed;
+  if (elapsed > _max_us) {
+    _max_us = elapsed;
+  }
+  return true;
+}
+
+bool SmartRelayRecovery::recover(SmartRelay &relay) {
+  uint8_t state_mask = 0;
+  uint8_t init_mask = 0;
+  return recover(relay, state_mask, init_mask);
+}
+
+bool SmartRelayRecovery::relaySet(SmartRelay &relay, uint8_t relay_id, bool on) {
+  if (relay_id > 7) {
+    return false;
+  }
+  bool ok = on ? relay.relayOn(relay_id) : relay.relayOff(relay_id);
+  if (ok || !relay.lastIoError()) {
+    return ok;  // BUSY or another clean answer: nothing to recover
+  }
+  _interrupted++;
+
+  uint8_t bit = (uint8_t)(1U << relay_id);
+  for (uint8_t retry = 0; retry <= _max_retries; retry++) {
+    uint8_t state_mask = 0;
+    uint8_t init_mask = 0;
+    if (!recover(relay, state_mask, init_mask)) {
+      return false;
+    }
+    // Executed before the abort, or never seen: the relay state tells which.
+    if ((init_mask & bit) && (((state_mask & bit) != 0) == on)) {
+      _applied++;
+      return true;
+    }
+    if (retry == _max_retries) {
+      break;
+    }
+    _retried++;
+    ok = on ? relay.relayOn(relay_id) : relay.relayOff(relay_id);
+    if (ok || !relay.lastIoError()) {
+      return ok;
+    }
+  }
+  return false;
+}
+
+bool SmartRelayRecovery::run(SmartRelay &relay, Operation op, void *arg) {
+  if (op == nullptr) {
+    return false;
+  }
+  bool ok = op(relay, arg);
+  if (ok || !relay.lastIoError()) {
+    return ok;
+  }
+  _interrupted++;
+  for (uint8_t retry = 0; retry < _max_retries; retry++) {
+    if (!recover(relay)) {
+      return false;
+    }
+    _retried++;
+    ok = op(relay, arg);
+    if (ok || !relay.lastIoError()) {
+      return ok;
+    }
+  }
+  return false;
+}
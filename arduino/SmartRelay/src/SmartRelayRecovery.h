@@ -0,0 +1,80 @@
+#ifndef SMART_RELAY_RECOVERY_ARDUINO_H
+#define SMART_RELAY_RECOVERY_ARDUINO_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "SmartRelay.h"
+
+// Bus fault recovery and session re-sync. After a command fails on the wire
+// (lastIoError()), recover() escalates SCL clock-out -> Wire restart ->
+// backoff until relayGetState() answers; relaySet() then uses that state to
+// decide whether the interrupted command already took effect.
+
+#define SMART_RELAY_RECOVERY_ATTEMPTS 8
+#define SMART_RELAY_RECOVERY_RETRIES 2
+#define SMART_RELAY_RECOVERY_BACKOFF_MAX_MS 64
+
+class SmartRelayRecovery {
+public:
+  typedef bool (*ClockOutHook)(void);
+  typedef void (*BusResetHook)(void);
+  typedef bool (*Operation)(SmartRelay &relay, void *arg);
+
+  explicit SmartRelayRecovery(TwoWire &wire = Wire, uint32_t clock_hz = 0);
+
+  // Enables the built-in clock-out on these pins (board SDA/SCL).
+  void setPins(uint8_t sda_pin, uint8_t scl_pin);
+  // Replaces the built-in clock-out / Wire restart, e.g. for a bus switch.
+  void setHooks(ClockOutHook clock_out, BusResetHook bus_reset);
+  void setAttempts(uint8_t max_attempts, uint8_t max_retries);
+
+  bool recover(SmartRelay &relay, uint8_t &out_state_mask, uint8_t &out_init_mask);
+  bool recover(SmartRelay &relay);
+  // relayOn()/relayOff() that survives an interrupted transfer.
+  bool relaySet(SmartRelay &relay, uint8_t relay_id, bool on);
+  // Retries op after recovery; only for commands that are safe to repeat.
+  bool run(SmartRelay &relay, Operation op, void *arg = nullptr);
+
+  // Nine SCL pulses until the slave releases SDA, then a STOP. The pins must
+  // not be owned by Wire at the time. Returns true when SDA reads high.
+  static bool clockOut(uint8_t sda_pin, uint8_t scl_pin);
+
+  uint32_t interrupted(void) const { return _interrupted; }
+  uint32_t recoveries(void) const { return _recoveries; }
+  uint32_t failures(void) const { return _failures; }
+  uint32_t clockOuts(void) const { return _clock_outs; }
+  uint32_t busResets(void) const { return _bus_resets; }
+  uint32_t resyncs(void) const { return _resyncs; }
+  uint32_t applied(void) const { return _applied; }
+  uint32_t retried(void) const { return _retried; }
+  uint32_t lastRecoveryUs(void) const { return _last_us; }
+  uint32_t maxRecoveryUs(void) const { return _max_us; }
+
+private:
+  void clockOutBus(void);
+  void resetBus(void);
+  bool probe(SmartRelay &relay, uint8_t &state_mask, uint8_t &init_mask, bool &io_error, uint8_t &status);
+
+  TwoWire *_wire;
+  uint32_t _clock_hz;
+  uint8_t _sda_pin;
+  uint8_t _scl_pin;
+  bool _pins_set;
+  ClockOutHook _clock_out;
+  BusResetHook _bus_reset;
+  uint8_t _max_attempts;
+  uint8_t _max_retries;
+
+  uint32_t _interrupted;
+  uint32_t _recoveries;
+  uint32_t _failures;
+  uint32_t _clock_outs;
+  uint32_t _bus_resets;
+  uint32_t _resyncs;
+  uint32_t _applied;
+  uint32_t _retried;
+  uint32_t _last_us;
+  uint32_t _max_us;
+};
+
+#endif // SMART_RELAY_RECOVERY_ARDUINO_H
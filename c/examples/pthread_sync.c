@@ -0,0 +1,112 @@
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "../smart_relay.h"
+#include "../sim/smart_relay_sim.h"
+
+// pthread adapter for smart_relay_sync_t. Several threads poll two devices
+// through shared handles; reads of the same device that pile up behind one
+// transaction are answered together, and the two devices proceed in parallel.
+//
+// Build: cc -std=c99 -pthread pthread_sync.c ../smart_relay.c ../sim/smart_relay_sim.c
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} pthread_sync_ctx_t;
+
+static void sync_lock(void *ctx) {
+  pthread_mutex_lock(&((pthread_sync_ctx_t *)ctx)->mutex);
+}
+
+static void sync_unlock(void *ctx) {
+  pthread_mutex_unlock(&((pthread_sync_ctx_t *)ctx)->mutex);
+}
+
+static void sync_wait(void *ctx) {
+  pthread_sync_ctx_t *c = (pthread_sync_ctx_t *)ctx;
+  pthread_cond_wait(&c->cond, &c->mutex);
+}
+
+static void sync_notify_all(void *ctx) {
+  pthread_cond_broadcast(&((pthread_sync_ctx_t *)ctx)->cond);
+}
+
+// The simulator is single-threaded; this stands in for an adapter driver that
+// carries one message at a time and takes real time to do it.
+static smart_relay_sim_bus_t bus;
+static pthread_mutex_t bus_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int bus_write(uint8_t addr, const uint8_t *data, uint8_t len) {
+  pthread_mutex_lock(&bus_mutex);
+  int ret = smart_relay_sim_write(&bus, addr, data, len);
+  uint32_t us = smart_relay_sim_transfer_us(&bus, len);
+  pthread_mutex_unlock(&bus_mutex);
+  usleep(us);
+  return ret;
+}
+
+static int bus_read(uint8_t addr, uint8_t *data, uint8_t len) {
+  pthread_mutex_lock(&bus_mutex);
+  int ret = smart_relay_sim_read(&bus, addr, data, len);
+  uint32_t us = smart_relay_sim_transfer_us(&bus, len);
+  pthread_mutex_unlock(&bus_mutex);
+  usleep(us);
+  return ret;
+}
+
+#define THREADS 8
+#define READS_PER_THREAD 200
+
+static pthread_sync_ctx_t sync_ctx = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static smart_relay_sync_t syncs[2];
+static smart_relay_t relays[2];
+static unsigned mismatches;
+
+static void *poller(void *arg) {
+  smart_relay_t *relay = &relays[(long)arg % 2];
+  uint8_t expected = (uint8_t)(1U << (relay == &relays[0] ? 1 : 2));
+  for (int i = 0; i < READS_PER_THREAD; i++) {
+    uint8_t state_mask = 0;
+    uint8_t init_mask = 0;
+    uint32_t trips = 0;
+    if (smart_relay_relay_get_state(relay, &state_mask, &init_mask) != SMART_RELAY_OK || state_mask != expected) {
+      __sync_fetch_and_add(&mismatches, 1);
+    }
+    if (smart_relay_watchdog_get_trip_count(relay, &trips) != SMART_RELAY_OK) {
+      __sync_fetch_and_add(&mismatches, 1);
+    }
+  }
+  return 0;
+}
+
+int main(void) {
+  smart_relay_sim_init(&bus);
+  smart_relay_sim_add(&bus, 0x2A);
+  smart_relay_sim_add(&bus, 0x2B);
+
+  for (int i = 0; i < 2; i++) {
+    smart_relay_sync_init(&syncs[i], &sync_ctx, sync_lock, sync_unlock, sync_wait, sync_notify_all);
+    relays[i].address = (uint8_t)(0x2A + i);
+    relays[i].i2c_write = bus_write;
+    relays[i].i2c_read = bus_read;
+    relays[i].sync = &syncs[i];
+  }
+  smart_relay_relay_on(&relays[0], 1);
+  smart_relay_relay_on(&relays[1], 2);
+
+  pthread_t threads[THREADS];
+  for (long t = 0; t < THREADS; t++) {
+    pthread_create(&threads[t], 0, poller, (void *)t);
+  }
+  for (int t = 0; t < THREADS; t++) {
+    pthread_join(threads[t], 0);
+  }
+
+  unsigned calls = THREADS * READS_PER_THREAD * 2;
+  unsigned transactions = syncs[0].transactions + syncs[1].transactions - 2;
+  printf("%u reads, %u bus transactions, %u coalesced, %u wrong answers\n", calls, transactions,
+         syncs[0].coalesced + syncs[1].coalesced, mismatches);
+  return mismatches ? 1 : 0;
+}
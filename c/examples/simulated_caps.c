@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include "../smart_relay.h"
+#include "../smart_relay_caps.h"
+#include "../sim/smart_relay_sim.h"
+
+// Runs against the simulator: a fleet with three firmware generations sets
+// four relays per board. Capabilities are probed once per firmware version
+// and each board gets the fastest command it supports. The baseline runs the
+// same scene as if no board had Relay Set Mask.
+
+#define BOARDS 24
+
+static smart_relay_sim_bus_t bus;
+static smart_relay_t relays[BOARDS];
+static smart_relay_caps_t caps[BOARDS];
+static smart_relay_caps_t legacy[BOARDS];
+static smart_relay_caps_cache_t cache;
+
+int main(void) {
+  smart_relay_sim_init(&bus);
+  smart_relay_sim_attach(&bus);
+  smart_relay_caps_cache_init(&cache);
+  for (uint8_t i = 0; i < BOARDS; i++) {
+    smart_relay_sim_dev_t *sim = smart_relay_sim_add(&bus, (uint8_t)(0x20 + i));
+    sim->relay_count = 4;
+    if (i % 3 == 0) {
+      // Oldest boards: no optional commands.
+      sim->fw_version = 0x0100;
+      sim->features = 0;
+    } else if (i % 3 == 1) {
+      sim->fw_version = 0x0102;
+      sim->features = SMART_RELAY_SIM_FEATURE_PEC | SMART_RELAY_SIM_FEATURE_GROUPS;
+    } else {
+      sim->fw_version = 0x0103;
+    }
+    relays[i].address = (uint8_t)(0x20 + i);
+    relays[i].i2c_write = smart_relay_sim_i2c_write;
+    relays[i].i2c_read = smart_relay_sim_i2c_read;
+    relays[i].delay_ms = smart_relay_sim_delay_ms;
+    smart_relay_caps_init(&caps[i], &relays[i], &cache);
+    smart_relay_caps_init(&legacy[i], &relays[i], 0);
+    legacy[i].known = 1;
+  }
+
+  uint64_t start = bus.now_us;
+  uint32_t transfers = bus.writes + bus.reads;
+  for (uint8_t i = 0; i < BOARDS; i++) {
+    uint8_t c = 0;
+    int ret = smart_relay_caps_query(&caps[i], &c);
+    if (i < 3) {
+      printf("board 0x%02X fw 0x%04X ret=%d caps=0x%02X\n", relays[i].address, caps[i].fw_version, ret, c);
+    }
+  }
+  printf("discovery: %llu us, %lu transfers, cache hits=%lu misses=%lu\n",
+         (unsigned long long)(bus.now_us - start), (unsigned long)(bus.writes + bus.reads - transfers),
+         (unsigned long)cache.hits, (unsigned long)cache.misses);
+
+  for (uint8_t round = 0; round < 2; round++) {
+    start = bus.now_us;
+    transfers = bus.writes + bus.reads;
+    for (uint8_t i = 0; i < BOARDS; i++) {
+      smart_relay_caps_relay_set_mask(round == 0 ? &legacy[i] : &caps[i], 0x0F, round == 0 ? 0x0A : 0x05);
+    }
+    printf("%s: %llu us, %lu transfers\n", round == 0 ? "per-relay scene" : "routed scene",
+           (unsigned long long)(bus.now_us - start), (unsigned long)(bus.writes + bus.reads - transfers));
+  }
+
+  uint8_t ok = 0;
+  for (uint8_t i = 0; i < BOARDS; i++) {
+    ok = (uint8_t)(ok + (bus.devices[i].state_mask == 0x05));
+  }
+  printf("%u of %u boards in the requested state\n", ok, BOARDS);
+  return 0;
+}
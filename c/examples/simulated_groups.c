@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include "../smart_relay.h"
+#include "../sim/smart_relay_sim.h"
+
+// Runs against the simulator: switches relay 1 on 30 boards, first with one
+// addressed command per board, then with a single group broadcast followed
+// by a confirmation sweep. One board misses the broadcast on purpose.
+
+#define BOARDS 30
+#define GROUP_LIGHTS 0x01
+
+static smart_relay_sim_bus_t bus;
+static smart_relay_t relays[BOARDS];
+static smart_relay_t *members[BOARDS];
+
+int main(void) {
+  smart_relay_sim_init(&bus);
+  smart_relay_sim_attach(&bus);
+  for (uint8_t i = 0; i < BOARDS; i++) {
+    smart_relay_sim_add(&bus, (uint8_t)(0x20 + i));
+    relays[i].address = (uint8_t)(0x20 + i);
+    relays[i].i2c_write = smart_relay_sim_i2c_write;
+    relays[i].i2c_read = smart_relay_sim_i2c_read;
+    relays[i].delay_ms = smart_relay_sim_delay_ms;
+    members[i] = &relays[i];
+    smart_relay_group_set(&relays[i], GROUP_LIGHTS);
+  }
+  smart_relay_sim_advance(&bus, 10);
+
+  uint64_t start = bus.now_us;
+  for (uint8_t i = 0; i < BOARDS; i++) {
+    smart_relay_relay_on(&relays[i], 1);
+  }
+  printf("addressed: %llu us from first to last board\n", (unsigned long long)(bus.now_us - start));
+  smart_relay_sim_advance(&bus, 10);
+
+  // Relay 1 off everywhere in one frame; board 7 sees a corrupted copy.
+  bus.devices[7].flip_next_write = 20;
+  start = bus.now_us;
+  int ret = smart_relay_group_relay_set(&relays[0], GROUP_LIGHTS, 1U << 1, 0x00, 1);
+  uint64_t broadcast_us = bus.now_us - start;
+
+  int results[BOARDS];
+  uint8_t failed = smart_relay_group_confirm(members, BOARDS, 1, results);
+  printf("broadcast: ret=%d, %llu us for all boards at once, sweep %llu us\n", ret,
+         (unsigned long long)broadcast_us, (unsigned long long)(bus.now_us - start - broadcast_us));
+  for (uint8_t i = 0; i < BOARDS; i++) {
+    if (results[i] != SMART_RELAY_OK) {
+      printf("board 0x%02X not confirmed (ret=%d), retrying addressed\n", relays[i].address, results[i]);
+      smart_relay_relay_off(&relays[i], 1);
+    }
+  }
+  printf("%u of %u boards confirmed\n", BOARDS - failed, BOARDS);
+  return 0;
+}
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include "../smart_relay.h"
+#include "../sim/smart_relay_sim.h"
+
+// Runs against the simulator: negotiates PEC, then shows that a flipped bit
+// in a response is rejected instead of being returned as a relay mask.
+
+static smart_relay_sim_bus_t bus;
+
+int main(void) {
+  smart_relay_sim_init(&bus);
+  smart_relay_sim_dev_t *sim = smart_relay_sim_add(&bus, 0x2A);
+  smart_relay_sim_attach(&bus);
+
+  smart_relay_t relay = {
+    .address = 0x2A,
+    .i2c_write = smart_relay_sim_i2c_write,
+    .i2c_read = smart_relay_sim_i2c_read,
+    .delay_ms = smart_relay_sim_delay_ms
+  };
+
+  if (smart_relay_pec_enable(&relay) != SMART_RELAY_OK) {
+    printf("device does not support PEC, staying in plain framing\n");
+  }
+  smart_relay_relay_on(&relay, 1);
+
+  uint8_t state_mask = 0;
+  uint8_t init_mask = 0;
+  sim->flip_next_read = 9;  // bit 0 of state_mask
+  int ret = smart_relay_relay_get_state(&relay, &state_mask, &init_mask);
+  printf("corrupted read: %s\n", ret == SMART_RELAY_ERR_PEC ? "rejected (PEC)" : "accepted");
+
+  ret = smart_relay_relay_get_state(&relay, &state_mask, &init_mask);
+  printf("retry: ret=%d state_mask=0x%02X pec_errors=%u\n", ret, state_mask, relay.pec_errors);
+
+  sim->flip_next_write = 12;  // relay_id bit of the next command
+  ret = smart_relay_relay_off(&relay, 1);
+  printf("corrupted command: %s\n", ret == SMART_RELAY_ERR_PEC ? "rejected by device" : "executed");
+
+  return 0;
+}
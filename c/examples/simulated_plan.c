@@ -0,0 +1,141 @@
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include "../smart_relay.h"
+#include "../smart_relay_caps.h"
+#include "../smart_relay_plan.h"
+#include "../sim/smart_relay_sim.h"
+
+// Runs against the simulator: 24 boards on two buses, every fourth one with
+// old firmware, and one board that has gone missing. A scene turns on the
+// "lights" load (relays 0 and 1 everywhere) and the "fans" load (relay 2 on
+// even boards), first one member at a time, then as a plan with one thread
+// per bus.
+//
+// Build: cc -std=c99 -pthread simulated_plan.c ../smart_relay.c ../smart_relay_caps.c
+//        ../smart_relay_plan.c ../sim/smart_relay_sim.c
+
+#define BUSES 2
+#define BOARDS_PER_BUS 12
+#define BOARDS (BUSES * BOARDS_PER_BUS)
+#define MISSING 17
+
+static smart_relay_sim_bus_t sim[BUSES];
+static smart_relay_t relays[BOARDS];
+static smart_relay_board_t boards[BOARDS];
+static smart_relay_caps_cache_t cache;
+static smart_relay_member_t lights[BOARDS * 2];
+static smart_relay_member_t fans[BOARDS / 2];
+static smart_relay_plan_t plan;
+
+// The simulator's attach() is global; each bus gets its own callbacks.
+static int bus0_write(uint8_t addr, const uint8_t *data, uint8_t len) { return smart_relay_sim_write(&sim[0], addr, data, len); }
+static int bus0_read(uint8_t addr, uint8_t *data, uint8_t len) { return smart_relay_sim_read(&sim[0], addr, data, len); }
+static void bus0_delay(uint16_t ms) { smart_relay_sim_advance(&sim[0], ms); }
+static int bus1_write(uint8_t addr, const uint8_t *data, uint8_t len) { return smart_relay_sim_write(&sim[1], addr, data, len); }
+static int bus1_read(uint8_t addr, uint8_t *data, uint8_t len) { return smart_relay_sim_read(&sim[1], addr, data, len); }
+static void bus1_delay(uint16_t ms) { smart_relay_sim_advance(&sim[1], ms); }
+
+static void *run_bus(void *arg) {
+  smart_relay_plan_execute_bus(&plan, (uint8_t)(uintptr_t)arg);
+  return 0;
+}
+
+static void mark(uint64_t *start, uint32_t *transfers) {
+  for (uint8_t b = 0; b < BUSES; b++) {
+    smart_relay_sim_advance(&sim[b], 100);
+    start[b] = sim[b].now_us;
+    transfers[b] = sim[b].writes + sim[b].reads;
+  }
+}
+
+static void report(const char *what, const uint64_t *start, const uint32_t *transfers, uint8_t parallel) {
+  uint64_t total = 0;
+  uint64_t longest = 0;
+  uint32_t count = 0;
+  for (uint8_t b = 0; b < BUSES; b++) {
+    uint64_t us = sim[b].now_us - start[b];
+    total += us;
+    longest = us > longest ? us : longest;
+    count += sim[b].writes + sim[b].reads - transfers[b];
+  }
+  printf("%s: %lu transfers, %llu us\n", what, (unsigned long)count,
+         (unsigned long long)(parallel ? longest : total));
+}
+
+int main(void) {
+  smart_relay_caps_cache_init(&cache);
+  uint8_t n_lights = 0;
+  uint8_t n_fans = 0;
+  for (uint8_t b = 0; b < BUSES; b++) {
+    smart_relay_sim_init(&sim[b]);
+  }
+  for (uint8_t i = 0; i < BOARDS; i++) {
+    uint8_t b = (uint8_t)(i / BOARDS_PER_BUS);
+    uint8_t address = (uint8_t)(0x20 + i % BOARDS_PER_BUS);
+    if (i != MISSING) {
+      smart_relay_sim_dev_t *dev = smart_relay_sim_add(&sim[b], address);
+      if (i % 4 == 0) {
+        dev->fw_version = 0x0100;
+        dev->features = 0;
+      } else {
+        dev->fw_version = 0x0103;
+      }
+    }
+    relays[i].address = address;
+    relays[i].i2c_write = b == 0 ? bus0_write : bus1_write;
+    relays[i].i2c_read = b == 0 ? bus0_read : bus1_read;
+    relays[i].delay_ms = b == 0 ? bus0_delay : bus1_delay;
+    smart_relay_caps_init(&boards[i].caps, &relays[i], &cache);
+    boards[i].bus = b;
+    // Before the bus threads start: execution only reads capabilities.
+    smart_relay_caps_query(&boards[i].caps, 0);
+
+    lights[n_lights].board = &boards[i];
+    lights[n_lights++].relay_id = 0;
+    lights[n_lights].board = &boards[i];
+    lights[n_lights++].relay_id = 1;
+    if (i % 2 == 0) {
+      fans[n_fans].board = &boards[i];
+      fans[n_fans++].relay_id = 2;
+    }
+  }
+  smart_relay_load_t lights_load = { lights, n_lights };
+  smart_relay_load_t fans_load = { fans, n_fans };
+
+  uint64_t start[BUSES];
+  uint32_t transfers[BUSES];
+
+  // Baseline: every member on its own, one bus after the other.
+  mark(start, transfers);
+  for (uint8_t i = 0; i < n_lights; i++) {
+    smart_relay_caps_relay_set_mask(&lights[i].board->caps, (uint8_t)(1U << lights[i].relay_id), 0x00);
+  }
+  for (uint8_t i = 0; i < n_fans; i++) {
+    smart_relay_caps_relay_set_mask(&fans[i].board->caps, (uint8_t)(1U << fans[i].relay_id), 0x00);
+  }
+  report("per member, lights+fans off", start, transfers, 0);
+
+  // Plan: one mask per board, frames back-to-back, buses in parallel.
+  smart_relay_plan_init(&plan);
+  smart_relay_plan_add(&plan, &lights_load, 1);
+  smart_relay_plan_add(&plan, &fans_load, 1);
+  mark(start, transfers);
+  pthread_t threads[BUSES];
+  for (uint8_t b = 0; b < BUSES; b++) {
+    pthread_create(&threads[b], 0, run_bus, (void *)(uintptr_t)b);
+  }
+  for (uint8_t b = 0; b < BUSES; b++) {
+    pthread_join(threads[b], 0);
+  }
+  report("plan, lights+fans on", start, transfers, 1);
+
+  for (uint8_t i = 0; i < n_lights; i++) {
+    int ret = smart_relay_plan_result(&plan, &lights[i]);
+    if (ret != SMART_RELAY_OK) {
+      printf("lights member bus %u addr 0x%02X relay %u failed (ret=%d)\n", lights[i].board->bus,
+             lights[i].board->caps.dev->address, lights[i].relay_id, ret);
+    }
+  }
+  return 0;
+}
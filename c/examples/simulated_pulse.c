@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../smart_relay.h"
+#include "../sim/smart_relay_sim.h"
+
+// Runs against the simulator: 20 ms pulses on relay 0, first timed by the
+// host (on, delay, off) with up to 5 ms of scheduler latency, then timed on
+// the device with Relay On For Ms. Reports transfers and pulse widths.
+
+#define PULSES 10
+#define WIDTH_MS 20
+
+static smart_relay_sim_bus_t bus;
+static smart_relay_t relay;
+
+// Advances in 10 us steps until relay 0 turns off; returns that time.
+static uint64_t wait_off(void) {
+  while (bus.devices[0].state_mask & 1U) {
+    smart_relay_sim_advance_us(&bus, 10);
+  }
+  return bus.now_us;
+}
+
+int main(void) {
+  smart_relay_sim_init(&bus);
+  smart_relay_sim_attach(&bus);
+  smart_relay_sim_add(&bus, 0x2A);
+  relay.address = 0x2A;
+  relay.i2c_write = smart_relay_sim_i2c_write;
+  relay.i2c_read = smart_relay_sim_i2c_read;
+  relay.delay_ms = smart_relay_sim_delay_ms;
+  smart_relay_relay_state_persist_disable(&relay);
+  srand(1);
+
+  for (uint8_t mode = 0; mode < 2; mode++) {
+    uint64_t min_us = UINT64_MAX;
+    uint64_t max_us = 0;
+    uint32_t transfers = bus.writes + bus.reads;
+    for (uint8_t i = 0; i < PULSES; i++) {
+      smart_relay_sim_advance(&bus, 50);
+      // Relays switch when the command write completes.
+      uint64_t on_us;
+      uint64_t width;
+      if (mode == 0) {
+        on_us = bus.now_us + smart_relay_sim_transfer_us(&bus, 2);
+        smart_relay_relay_on(&relay, 0);
+        smart_relay_sim_advance_us(&bus, (uint64_t)WIDTH_MS * 1000 + (uint64_t)(rand() % 5000));
+        width = bus.now_us + smart_relay_sim_transfer_us(&bus, 2) - on_us;
+        smart_relay_relay_off(&relay, 0);
+      } else {
+        on_us = bus.now_us + smart_relay_sim_transfer_us(&bus, 4);
+        smart_relay_relay_on_for_ms(&relay, 0, WIDTH_MS);
+        width = wait_off() - on_us;
+      }
+      min_us = width < min_us ? width : min_us;
+      max_us = width > max_us ? width : max_us;
+    }
+    printf("%s: %lu transfers, width %llu..%llu us\n", mode == 0 ? "host-timed" : "on_for_ms",
+           (unsigned long)(bus.writes + bus.reads - transfers), (unsigned long long)min_us,
+           (unsigned long long)max_us);
+  }
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include "../smart_relay.h"
+#include "../smart_relay_recovery.h"
+#include "../sim/smart_relay_sim.h"
+
+// Runs against the simulator: switches a relay through each kind of bus
+// fault and shows whether the command was found applied or sent again.
+
+static smart_relay_sim_bus_t bus;
+static smart_relay_t relay;
+static smart_relay_recovery_t rec;
+
+static void report(const char *what, int ret) {
+  // Let EEPROM writes settle between scenarios.
+  smart_relay_sim_advance(&bus, 20);
+  printf("%-34s ret=%d applied=%lu retried=%lu last=%lu us\n", what, ret, (unsigned long)rec.applied,
+         (unsigned long)rec.retried, (unsigned long)rec.last_us);
+}
+
+static int ping(smart_relay_t *dev, void *arg) {
+  (void)arg;
+  return smart_relay_watchdog_ping(dev);
+}
+
+int main(void) {
+  smart_relay_sim_init(&bus);
+  smart_relay_sim_attach(&bus);
+  smart_relay_sim_add(&bus, 0x2A);
+  relay.address = 0x2A;
+  relay.i2c_write = smart_relay_sim_i2c_write;
+  relay.i2c_read = smart_relay_sim_i2c_read;
+  relay.delay_ms = smart_relay_sim_delay_ms;
+  smart_relay_recovery_init(&rec, smart_relay_sim_clock_out, smart_relay_sim_bus_reset, smart_relay_sim_micros);
+  smart_relay_pec_enable(&relay);
+
+  // Response read aborted after the device switched: nothing to re-send.
+  bus.abort_reads = 1;
+  report("read aborted, relay 0 on", smart_relay_recovery_relay_set(&rec, &relay, 0, 1));
+
+  // Slave holds SDA low: the command never arrived and goes out again.
+  bus.sda_stuck = 1;
+  report("SDA stuck, relay 0 off", smart_relay_recovery_relay_set(&rec, &relay, 0, 0));
+
+  // Adapter wedged: clock-out alone does not help, the reset does.
+  bus.adapter_hung = 1;
+  report("adapter hung, relay 1 on", smart_relay_recovery_relay_set(&rec, &relay, 1, 1));
+
+  // NACK storm: waited out with backoff.
+  bus.nack_burst = 8;
+  report("NACK storm, relay 1 off", smart_relay_recovery_relay_set(&rec, &relay, 1, 0));
+
+  // CRC error on the recovery probe while the device keeps PEC: resync must
+  // leave both sides framing with PEC.
+  bus.abort_reads = 1;
+  bus.devices[0].flip_next_read = 3;
+  report("probe CRC error, relay 0 on", smart_relay_recovery_relay_set(&rec, &relay, 0, 1));
+  printf("%-34s host=%u device=%u\n", "PEC after probe CRC error", relay.pec, bus.devices[0].pec);
+
+  // Device brown-out: back with PEC off, session renegotiated.
+  smart_relay_sim_device_reset(&bus.devices[0]);
+  report("device reset, watchdog ping", smart_relay_recovery_run(&rec, &relay, ping, 0));
+
+  printf("interrupted=%lu recoveries=%lu failures=%lu clock_outs=%lu resets=%lu resyncs=%lu max=%lu us\n",
+         (unsigned long)rec.interrupted, (unsigned long)rec.recoveries, (unsigned long)rec.failures,
+         (unsigned long)rec.clock_outs, (unsigned long)rec.bus_resets, (unsigned long)rec.resyncs,
+         (unsigned long)rec.max_us);
+  return 0;
+}
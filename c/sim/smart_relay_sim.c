@@ -0,0 +1,831 @@
+#include "smart_relay_sim.h"
+
+#include <string.h>
+
+static smart_relay_sim_bus_t *active_bus = 0;
+
+static void set_defaults(smart_relay_sim_dev_t *dev) {
+  dev->wd_enabled = 0;
+  dev->wd_relay = 0;
+  dev->wd_active_state = 1;
+  dev->wd_timeout_sec = SMART_RELAY_SIM_DEFAULT_PING_TIMEOUT_SEC;
+  dev->wd_reset_sec = SMART_RELAY_SIM_DEFAULT_RESET_SEC;
+  dev->pc_enabled = 0;
+  dev->pc_relay = 0;
+  dev->pc_sleep_enable = 0;
+  dev->pc_max_on_sec = SMART_RELAY_SIM_DEFAULT_MAX_ON_SEC;
+  dev->pc_off_sec = SMART_RELAY_SIM_DEFAULT_OFF_SEC;
+  dev->persist = 1;
+  dev->trip_count = 0;
+  dev->groups = 0;
+}
+
+void smart_relay_sim_init(smart_relay_sim_bus_t *bus) {
+  if (bus == 0) {
+    return;
+  }
+  memset(bus, 0, sizeof(*bus));
+  bus->rng = 0x2A2A2A2AUL;
+  bus->clock_hz = SMART_RELAY_SIM_DEFAULT_CLOCK_HZ;
+}
+
+smart_relay_sim_dev_t *smart_relay_sim_add(smart_relay_sim_bus_t *bus, uint8_t address) {
+  if (bus == 0 || bus->count >= SMART_RELAY_SIM_MAX_DEVICES || smart_relay_sim_find(bus, address) != 0) {
+    return 0;
+  }
+  smart_relay_sim_dev_t *dev = &bus->devices[bus->count++];
+  memset(dev, 0, sizeof(*dev));
+  dev->address = address;
+  dev->pending_address = address;
+  dev->relay_count = SMART_RELAY_SIM_DEFAULT_RELAYS;
+  dev->features = SMART_RELAY_SIM_FEATURE_ALL;
+  dev->vendor_id = 0x0001;
+  dev->product_id = 0x0001;
+  dev->revision = 1;
+  dev->fw_version = 0x0100;
+  dev->eeprom_version = 1;
+  dev->eeprom_busy_us = SMART_RELAY_SIM_EEPROM_BUSY_US;
+  set_defaults(dev);
+  smart_relay_sim_device_reset(dev);
+  return dev;
+}
+
+smart_relay_sim_dev_t *smart_relay_sim_find(smart_relay_sim_bus_t *bus, uint8_t address) {
+  if (bus == 0) {
+    return 0;
+  }
+  for (uint8_t i = 0; i < bus->count; i++) {
+    if (bus->devices[i].address == address) {
+      return &bus->devices[i];
+    }
+  }
+  return 0;
+}
+
+static void set_relay(smart_relay_sim_dev_t *dev, uint8_t relay_id, uint8_t on) {
+  uint8_t bit = (uint8_t)(1U << relay_id);
+  dev->init_mask |= bit;
+  if (on) {
+    dev->state_mask |= bit;
+  } else {
+    dev->state_mask &= (uint8_t)~bit;
+  }
+}
+
+static void wd_restart(smart_relay_sim_dev_t *dev) {
+  dev->wd_in_reset = 0;
+  dev->wd_remaining_us = (uint64_t)dev->wd_timeout_sec * 1000000ULL * dev->wd_backoff;
+}
+
+static void pc_power_on(smart_relay_sim_dev_t *dev) {
+  dev->pc_off = 0;
+  set_relay(dev, dev->pc_relay, 1);
+  dev->pc_remaining_us = (uint64_t)dev->pc_max_on_sec * 1000000ULL;
+}
+
+static void pc_power_off(smart_relay_sim_dev_t *dev, uint16_t off_sec) {
+  dev->pc_off = 1;
+  set_relay(dev, dev->pc_relay, 0);
+  dev->pc_remaining_us = (uint64_t)off_sec * 1000000ULL;
+}
+
+void smart_relay_sim_device_reset(smart_relay_sim_dev_t *dev) {
+  if (dev == 0) {
+    return;
+  }
+  dev->address = dev->pending_address;
+  dev->pec = 0;
+  dev->busy_us = 0;
+  dev->resp_len = 0;
+  dev->timer_mask = 0;
+  if (!dev->persist) {
+    dev->state_mask = 0;
+    dev->init_mask = 0;
+  }
+  dev->wd_backoff = 1;
+  if (dev->wd_enabled) {
+    set_relay(dev, dev->wd_relay, (uint8_t)!dev->wd_active_state);
+    wd_restart(dev);
+  }
+  if (dev->pc_enabled) {
+    pc_power_on(dev);
+  }
+}
+
+static void eeprom_write(smart_relay_sim_dev_t *dev) {
+  dev->eeprom_writes++;
+  if (dev->eeprom_writes % SMART_RELAY_SIM_SHIFT_THRESHOLD == 0 && dev->shift_count < 0xFF) {
+    dev->shift_count++;
+  }
+  dev->busy_us = dev->eeprom_busy_us;
+}
+
+static uint8_t asleep(const smart_relay_sim_dev_t *dev) {
+  return dev->pc_enabled && dev->pc_off && dev->pc_sleep_enable;
+}
+
+uint64_t smart_relay_sim_next_event_us(const smart_relay_sim_dev_t *dev) {
+  uint64_t next = UINT64_MAX;
+  if (dev == 0) {
+    return next;
+  }
+  if (dev->busy_us > 0) {
+    next = dev->busy_us;
+  }
+  for (uint8_t i = 0; i < SMART_RELAY_SIM_MAX_RELAYS; i++) {
+    if ((dev->timer_mask & (1U << i)) && dev->timer_us[i] < next) {
+      next = dev->timer_us[i];
+    }
+  }
+  if (dev->wd_enabled && dev->wd_remaining_us < next) {
+    next = dev->wd_remaining_us;
+  }
+  if (dev->pc_enabled && dev->pc_remaining_us > 0 && dev->pc_remaining_us < next) {
+    next = dev->pc_remaining_us;
+  }
+  return next;
+}
+
+static void tick(smart_relay_sim_dev_t *dev, uint64_t step) {
+  dev->busy_us = dev->busy_us > step ? (uint32_t)(dev->busy_us - step) : 0;
+
+  for (uint8_t i = 0; i < SMART_RELAY_SIM_MAX_RELAYS; i++) {
+    uint8_t bit = (uint8_t)(1U << i);
+    if (!(dev->timer_mask & bit)) {
+      continue;
+    }
+    if (dev->timer_us[i] > step) {
+      dev->timer_us[i] -= step;
+      continue;
+    }
+    dev->timer_mask &= (uint8_t)~bit;
+    set_relay(dev, i, (dev->timer_revert_mask & bit) ? 1 : 0);
+  }
+
+  if (dev->wd_enabled) {
+    if (dev->wd_remaining_us > step) {
+      dev->wd_remaining_us -= step;
+    } else if (dev->wd_in_reset) {
+      // Reset pulse over: the ping timeout is counted from here.
+      set_relay(dev, dev->wd_relay, (uint8_t)!dev->wd_active_state);
+      wd_restart(dev);
+    } else {
+      dev->trip_count++;
+      eeprom_write(dev);
+      set_relay(dev, dev->wd_relay, dev->wd_active_state);
+      dev->wd_in_reset = 1;
+      dev->wd_remaining_us = (uint64_t)dev->wd_reset_sec * 1000000ULL;
+      if (dev->wd_backoff < SMART_RELAY_SIM_WD_MAX_BACKOFF) {
+        dev->wd_backoff = (uint8_t)(dev->wd_backoff * 2);
+      }
+    }
+  }
+
+  if (dev->pc_enabled && dev->pc_remaining_us > 0) {
+    if (dev->pc_remaining_us > step) {
+      dev->pc_remaining_us -= step;
+    } else if (dev->pc_off) {
+      pc_power_on(dev);
+    } else {
+      // Stuck master fallback: sleep for the last configured off duration.
+      pc_power_off(dev, dev->pc_off_sec);
+    }
+  }
+}
+
+void smart_relay_sim_device_advance(smart_relay_sim_dev_t *dev, uint64_t us) {
+  if (dev == 0) {
+    return;
+  }
+  while (us > 0) {
+    uint64_t step = smart_relay_sim_next_event_us(dev);
+    if (step == 0) {
+      step = 1;
+    }
+    if (step > us) {
+      step = us;
+    }
+    tick(dev, step);
+    us -= step;
+  }
+}
+
+void smart_relay_sim_advance_us(smart_relay_sim_bus_t *bus, uint64_t us) {
+  if (bus == 0) {
+    return;
+  }
+  for (uint8_t i = 0; i < bus->count; i++) {
+    smart_relay_sim_device_advance(&bus->devices[i], us);
+  }
+  bus->now_us += us;
+}
+
+void smart_relay_sim_advance(smart_relay_sim_bus_t *bus, uint32_t ms) {
+  smart_relay_sim_advance_us(bus, (uint64_t)ms * 1000ULL);
+}
+
+uint32_t smart_relay_sim_transfer_us(const smart_relay_sim_bus_t *bus, uint8_t len) {
+  if (bus == 0 || bus->clock_hz == 0) {
+    return 0;
+  }
+  // START + address byte + data bytes (9 clocks each with ACK) + STOP
+  uint32_t bits = 1U + 9U * (1U + len) + 1U;
+  return (uint32_t)(((uint64_t)bits * 1000000ULL + bus->clock_hz - 1) / bus->clock_hz);
+}
+
+static uint32_t next_random(smart_relay_sim_bus_t *bus) {
+  uint32_t x = bus->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  bus->rng = x;
+  return x;
+}
+
+static void line_noise(smart_relay_sim_bus_t *bus, uint8_t *data, uint8_t len) {
+  bus->bytes += len;
+  if (bus->bit_error_ppm == 0) {
+    return;
+  }
+  for (uint8_t i = 0; i < len; i++) {
+    for (uint8_t b = 0; b < 8; b++) {
+      if (next_random(bus) % 1000000UL < bus->bit_error_ppm) {
+        data[i] ^= (uint8_t)(1U << b);
+      }
+    }
+  }
+}
+
+static void flip_bit(uint8_t *data, uint8_t len, uint8_t *flip) {
+  if (*flip == 0) {
+    return;
+  }
+  uint8_t bit = (uint8_t)(*flip - 1);
+  if (bit / 8 < len) {
+    data[bit / 8] ^= (uint8_t)(1U << (bit % 8));
+  }
+  *flip = 0;
+}
+
+static void respond(smart_relay_sim_dev_t *dev, uint8_t status, const uint8_t *data, uint8_t len) {
+  dev->resp[0] = status;
+  if (status != STATUS_OK) {
+    len = 0;
+  }
+  for (uint8_t i = 0; i < len; i++) {
+    dev->resp[1 + i] = data[i];
+  }
+  dev->resp_len = (uint8_t)(1 + len);
+  if (status == STATUS_BUSY) {
+    dev->busy_replies++;
+  }
+  if (dev->pec) {
+    uint8_t addr_r = (uint8_t)((dev->address << 1) | 1);
+    dev->resp[dev->resp_len] = smart_relay_crc8(smart_relay_crc8(0, &addr_r, 1), dev->resp, dev->resp_len);
+    dev->resp_len++;
+  }
+}
+
+static uint16_t u16_at(const uint8_t *p) {
+  return (uint16_t)(p[0] | ((uint16_t)p[1] << 8));
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static uint16_t ceil_sec(uint64_t us) {
+  uint64_t sec = (us + 999999ULL) / 1000000ULL;
+  return sec > 0xFFFF ? 0xFFFF : (uint16_t)sec;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+  p[2] = (uint8_t)((v >> 16) & 0xFF);
+  p[3] = (uint8_t)((v >> 24) & 0xFF);
+}
+
+static uint8_t writes_eeprom(const smart_relay_sim_dev_t *dev, uint8_t cmd) {
+  switch (cmd) {
+    case CMD_RELAY_ON:
+    case CMD_RELAY_OFF:
+      return dev->persist;
+    case CMD_WATCHDOG_ENABLE:
+    case CMD_WATCHDOG_DISABLE:
+    case CMD_WATCHDOG_SET_PING_TIMEOUT:
+    case CMD_WATCHDOG_SET_RESET_DURATION:
+    case CMD_WATCHDOG_CLEAR_TRIP_COUNT:
+    case CMD_EEPROM_CLEAR:
+    case CMD_POWER_CYCLE_ENABLE:
+    case CMD_POWER_CYCLE_DISABLE:
+    case CMD_POWER_CYCLE_SET_MAX_ON_TIME:
+    case CMD_RELAY_STATE_PERSIST_ENABLE:
+    case CMD_RELAY_STATE_PERSIST_DISABLE:
+    case CMD_I2C_SET_ADDRESS:
+    case CMD_WATCHDOG_SET_RESET_ACTIVE_STATE:
+    case CMD_GROUP_SET:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static uint8_t status_block(const smart_relay_sim_dev_t *dev, uint8_t *block, uint8_t max_len) {
+  uint8_t full[SMART_RELAY_STATUS_LEN];
+  memset(full, 0, sizeof(full));
+  full[0] = SMART_RELAY_STATUS_VERSION;
+  full[2] = dev->state_mask;
+  full[3] = dev->init_mask;
+  full[4] = (uint8_t)((dev->persist ? SMART_RELAY_STATUS_RELAY_PERSIST : 0) |
+                      (dev->wd_active_state ? SMART_RELAY_STATUS_RESET_ACTIVE_ON : 0) |
+                      (dev->wd_enabled && dev->wd_in_reset ? SMART_RELAY_STATUS_WD_IN_RESET : 0) |
+                      (dev->pc_enabled && dev->pc_off ? SMART_RELAY_STATUS_PC_OFF : 0) |
+                      (dev->pc_sleep_enable ? SMART_RELAY_STATUS_PC_SLEEP : 0));
+  if (dev->wd_enabled) {
+    full[5] = SMART_RELAY_MODE_WATCHDOG;
+    full[6] = dev->wd_relay;
+    put_u16(full + 16, ceil_sec(dev->wd_remaining_us));
+  } else if (dev->pc_enabled) {
+    full[5] = SMART_RELAY_MODE_POWER_CYCLE;
+    full[6] = dev->pc_relay;
+    put_u16(full + 18, ceil_sec(dev->pc_remaining_us));
+  }
+  full[7] = dev->shift_count;
+  put_u32(full + 8, dev->trip_count);
+  put_u32(full + 12, dev->eeprom_writes);
+  full[20] = dev->timer_mask;
+  uint64_t next = UINT64_MAX;
+  for (uint8_t i = 0; i < SMART_RELAY_SIM_MAX_RELAYS; i++) {
+    if ((dev->timer_mask & (1U << i)) && dev->timer_us[i] < next) {
+      next = dev->timer_us[i];
+    }
+  }
+  put_u16(full + 21, next == UINT64_MAX ? 0 : ceil_sec(next));
+
+  // Hosts that know fewer fields get a truncated block.
+  uint8_t len = max_len < sizeof(full) ? max_len : (uint8_t)sizeof(full);
+  full[1] = len;
+  memcpy(block, full, len);
+  return len;
+}
+
+static void execute(smart_relay_sim_dev_t *dev, const uint8_t *frame, uint8_t len) {
+  uint8_t data[SMART_RELAY_MAX_RESPONSE];
+  uint8_t cmd = frame[0];
+  const uint8_t *p = frame + 1;
+  uint8_t plen = (uint8_t)(len - 1);
+
+  dev->commands++;
+
+  if (dev->busy_us > 0 && writes_eeprom(dev, cmd)) {
+    respond(dev, STATUS_BUSY, 0, 0);
+    return;
+  }
+
+  switch (cmd) {
+    case CMD_RELAY_ON:
+    case CMD_RELAY_OFF:
+      if (plen < 1 || p[0] >= dev->relay_count) break;
+      dev->timer_mask &= (uint8_t)~(1U << p[0]);
+      set_relay(dev, p[0], cmd == CMD_RELAY_ON);
+      if (dev->persist) eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_RELAY_SET_MASK:
+      if (!(dev->features & SMART_RELAY_SIM_FEATURE_RELAY_MASK)) {
+        respond(dev, STATUS_BAD_CMD, 0, 0);
+        return;
+      }
+      if (plen < 2 || (p[0] >> dev->relay_count) != 0) break;
+      if (p[0] != 0 && dev->persist && dev->busy_us > 0) {
+        respond(dev, STATUS_BUSY, 0, 0);
+        return;
+      }
+      for (uint8_t i = 0; i < dev->relay_count; i++) {
+        if (p[0] & (1U << i)) {
+          dev->timer_mask &= (uint8_t)~(1U << i);
+          set_relay(dev, i, (p[1] >> i) & 1);
+        }
+      }
+      if (p[0] != 0 && dev->persist) eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_RELAY_ON_FOR_MS:
+    case CMD_RELAY_OFF_FOR_MS:
+      if (!(dev->features & SMART_RELAY_SIM_FEATURE_PULSE_MS)) {
+        respond(dev, STATUS_BAD_CMD, 0, 0);
+        return;
+      }
+      // fall through
+    case CMD_RELAY_ON_FOR:
+    case CMD_RELAY_OFF_FOR: {
+      if (plen < 3 || p[0] >= dev->relay_count || u16_at(p + 1) == 0) break;
+      uint8_t on = cmd == CMD_RELAY_ON_FOR || cmd == CMD_RELAY_ON_FOR_MS;
+      uint64_t unit_us = (cmd == CMD_RELAY_ON_FOR || cmd == CMD_RELAY_OFF_FOR) ? 1000000ULL : 1000ULL;
+      uint8_t bit = (uint8_t)(1U << p[0]);
+      set_relay(dev, p[0], on);
+      dev->timer_mask |= bit;
+      if (on) {
+        dev->timer_revert_mask &= (uint8_t)~bit;
+      } else {
+        dev->timer_revert_mask |= bit;
+      }
+      dev->timer_us[p[0]] = (uint64_t)u16_at(p + 1) * unit_us;
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+    }
+
+    case CMD_WATCHDOG_ENABLE:
+      if (plen < 1 || p[0] >= dev->relay_count) break;
+      dev->pc_enabled = 0;
+      dev->wd_enabled = 1;
+      dev->wd_relay = p[0];
+      dev->wd_backoff = 1;
+      set_relay(dev, dev->wd_relay, (uint8_t)!dev->wd_active_state);
+      wd_restart(dev);
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_WATCHDOG_DISABLE:
+      dev->wd_enabled = 0;
+      dev->wd_in_reset = 0;
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_WATCHDOG_PING:
+      if (dev->wd_enabled) {
+        dev->wd_backoff = 1;
+        if (!dev->wd_in_reset) {
+          wd_restart(dev);
+        }
+      }
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_WATCHDOG_SET_PING_TIMEOUT:
+    case CMD_WATCHDOG_SET_RESET_DURATION:
+      if (plen < 2 || u16_at(p) == 0) break;
+      if (cmd == CMD_WATCHDOG_SET_PING_TIMEOUT) {
+        dev->wd_timeout_sec = u16_at(p);
+      } else {
+        dev->wd_reset_sec = u16_at(p);
+      }
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_WATCHDOG_GET_TRIP_COUNT:
+      put_u32(data, dev->trip_count);
+      respond(dev, STATUS_OK, data, 4);
+      return;
+
+    case CMD_WATCHDOG_CLEAR_TRIP_COUNT:
+      dev->trip_count = 0;
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_EEPROM_CLEAR:
+      set_defaults(dev);
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_POWER_CYCLE_ENABLE:
+      if (plen < 1 || p[0] >= dev->relay_count) break;
+      dev->wd_enabled = 0;
+      dev->pc_enabled = 1;
+      dev->pc_relay = p[0];
+      dev->pc_sleep_enable = (plen >= 2 && p[1]) ? 1 : 0;
+      pc_power_on(dev);
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_POWER_CYCLE_DISABLE:
+      dev->pc_enabled = 0;
+      dev->pc_off = 0;
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_POWER_CYCLE_SET_MAX_ON_TIME:
+      if (plen < 2) break;
+      dev->pc_max_on_sec = u16_at(p);
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_POWER_CYCLE_SLEEP:
+      if (plen < 2) break;
+      if (!dev->pc_enabled) {
+        respond(dev, STATUS_ERR, 0, 0);
+        return;
+      }
+      dev->pc_off_sec = u16_at(p);
+      pc_power_off(dev, dev->pc_off_sec);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_RELAY_STATE_PERSIST_ENABLE:
+    case CMD_RELAY_STATE_PERSIST_DISABLE:
+      dev->persist = cmd == CMD_RELAY_STATE_PERSIST_ENABLE;
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_RELAY_STATE_PERSIST_GET:
+      data[0] = dev->persist;
+      respond(dev, STATUS_OK, data, 1);
+      return;
+
+    case CMD_RELAY_GET_STATE:
+      data[0] = dev->state_mask;
+      data[1] = dev->init_mask;
+      respond(dev, STATUS_OK, data, 2);
+      return;
+
+    case CMD_I2C_SET_ADDRESS:
+      if (plen < 1 || p[0] < 0x08 || p[0] > 0x77) break;
+      dev->pending_address = p[0];
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_EEPROM_GET_WRITE_COUNT:
+      put_u32(data, dev->eeprom_writes);
+      respond(dev, STATUS_OK, data, 4);
+      return;
+
+    case CMD_WATCHDOG_SET_RESET_ACTIVE_STATE:
+      if (plen < 1 || p[0] > 1) break;
+      dev->wd_active_state = p[0];
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_WATCHDOG_GET_RESET_ACTIVE_STATE:
+      data[0] = dev->wd_active_state;
+      respond(dev, STATUS_OK, data, 1);
+      return;
+
+    case CMD_EEPROM_GET_SHIFT_COUNT:
+      data[0] = dev->shift_count;
+      respond(dev, STATUS_OK, data, 1);
+      return;
+
+    case CMD_FIRMWARE_GET_VERSION:
+      data[0] = (uint8_t)(dev->fw_version & 0xFF);
+      data[1] = (uint8_t)(dev->fw_version >> 8);
+      respond(dev, STATUS_OK, data, 2);
+      return;
+
+    case CMD_EEPROM_GET_VERSION:
+      data[0] = dev->eeprom_version;
+      respond(dev, STATUS_OK, data, 1);
+      return;
+
+    case CMD_DEVICE_INFO:
+      data[0] = (uint8_t)(dev->vendor_id & 0xFF);
+      data[1] = (uint8_t)(dev->vendor_id >> 8);
+      data[2] = (uint8_t)(dev->product_id & 0xFF);
+      data[3] = (uint8_t)(dev->product_id >> 8);
+      data[4] = dev->revision;
+      data[5] = (uint8_t)(dev->fw_version & 0xFF);
+      data[6] = (uint8_t)(dev->fw_version >> 8);
+      respond(dev, STATUS_OK, data, 7);
+      return;
+
+    case CMD_PEC_SET:
+      if (!(dev->features & SMART_RELAY_SIM_FEATURE_PEC)) {
+        respond(dev, STATUS_BAD_CMD, 0, 0);
+        return;
+      }
+      if (plen < 1 || p[0] > 1) break;
+      // Reply in the old framing, then switch.
+      respond(dev, STATUS_OK, 0, 0);
+      dev->pec = p[0];
+      return;
+
+    case CMD_GROUP_SET:
+      if (!(dev->features & SMART_RELAY_SIM_FEATURE_GROUPS)) {
+        respond(dev, STATUS_BAD_CMD, 0, 0);
+        return;
+      }
+      if (plen < 1) break;
+      dev->groups = p[0];
+      eeprom_write(dev);
+      respond(dev, STATUS_OK, 0, 0);
+      return;
+
+    case CMD_GROUP_GET:
+      if (!(dev->features & SMART_RELAY_SIM_FEATURE_GROUPS)) {
+        respond(dev, STATUS_BAD_CMD, 0, 0);
+        return;
+      }
+      data[0] = dev->groups;
+      data[1] = dev->group_seq;
+      data[2] = dev->group_status;
+      respond(dev, STATUS_OK, data, 3);
+      return;
+
+    case CMD_GET_ALL_STATUS:
+      if (!(dev->features & SMART_RELAY_SIM_FEATURE_ALL_STATUS)) {
+        respond(dev, STATUS_BAD_CMD, 0, 0);
+        return;
+      }
+      if (plen < 1 || p[0] < 2) break;
+      respond(dev, STATUS_OK, data, status_block(dev, data, p[0]));
+      return;
+
+    default:
+      respond(dev, STATUS_BAD_CMD, 0, 0);
+      return;
+  }
+  respond(dev, STATUS_BAD_PARAM, 0, 0);
+}
+
+// Group Relay Set as seen by one device: frame is cmd, group_mask,
+// relay_mask, state_mask, seq (PEC already checked).
+static void execute_group(smart_relay_sim_dev_t *dev, const uint8_t *frame) {
+  if (!(dev->groups & frame[1])) {
+    return;
+  }
+  dev->commands++;
+  uint8_t relay_mask = (uint8_t)(frame[2] & ((1U << dev->relay_count) - 1));
+  uint8_t status = STATUS_OK;
+  if (relay_mask != 0 && dev->persist && dev->busy_us > 0) {
+    status = STATUS_BUSY;
+  } else {
+    for (uint8_t i = 0; i < dev->relay_count; i++) {
+      if (relay_mask & (1U << i)) {
+        dev->timer_mask &= (uint8_t)~(1U << i);
+        set_relay(dev, i, (frame[3] >> i) & 1);
+      }
+    }
+    if (relay_mask != 0 && dev->persist) {
+      eeprom_write(dev);
+    }
+  }
+  dev->group_seq = frame[4];
+  dev->group_status = status;
+  uint8_t data[2] = { frame[4], (uint8_t)~frame[4] };
+  respond(dev, status, data, 2);
+}
+
+static int general_call(smart_relay_sim_bus_t *bus, const uint8_t *data, uint8_t len) {
+  uint8_t acked = 0;
+  uint8_t wire[SMART_RELAY_MAX_RESPONSE];
+  if (len == 0 || len > SMART_RELAY_MAX_RESPONSE) {
+    bus->nacks++;
+    return -1;
+  }
+  memcpy(wire, data, len);
+  line_noise(bus, wire, len);
+
+  for (uint8_t i = 0; i < bus->count; i++) {
+    smart_relay_sim_dev_t *dev = &bus->devices[i];
+    if (!(dev->features & SMART_RELAY_SIM_FEATURE_GROUPS) || asleep(dev)) {
+      continue;
+    }
+    acked = 1;
+    uint8_t frame[SMART_RELAY_MAX_RESPONSE];
+    memcpy(frame, wire, len);
+    flip_bit(frame, len, &dev->flip_next_write);
+    // Other general-call commands (I2C spec 0x04/0x06) are ignored.
+    uint8_t addr_w = (uint8_t)(SMART_RELAY_GENERAL_CALL << 1);
+    if (len != 6 || frame[0] != CMD_GROUP_RELAY_SET ||
+        smart_relay_crc8(smart_relay_crc8(0, &addr_w, 1), frame, 5) != frame[5]) {
+      if (len == 6 && frame[0] == CMD_GROUP_RELAY_SET) {
+        dev->pec_errors++;
+      }
+      continue;
+    }
+    execute_group(dev, frame);
+  }
+  if (!acked) {
+    bus->nacks++;
+    return -1;
+  }
+  return 0;
+}
+
+static uint8_t bus_fault(smart_relay_sim_bus_t *bus) {
+  if (bus->sda_stuck || bus->adapter_hung) {
+    return 1;
+  }
+  if (bus->nack_burst > 0) {
+    bus->nack_burst--;
+    return 1;
+  }
+  return 0;
+}
+
+int smart_relay_sim_write(smart_relay_sim_bus_t *bus, uint8_t addr, const uint8_t *data, uint8_t len) {
+  if (bus == 0) {
+    return -1;
+  }
+  bus->writes++;
+  smart_relay_sim_advance_us(bus, smart_relay_sim_transfer_us(bus, len));
+  if (bus_fault(bus)) {
+    bus->nacks++;
+    return -1;
+  }
+  if (addr == SMART_RELAY_GENERAL_CALL) {
+    return general_call(bus, data, len);
+  }
+  smart_relay_sim_dev_t *dev = smart_relay_sim_find(bus, addr);
+  if (dev == 0 || asleep(dev) || len == 0 || len > SMART_RELAY_MAX_RESPONSE) {
+    bus->nacks++;
+    return -1;
+  }
+
+  uint8_t frame[SMART_RELAY_MAX_RESPONSE];
+  memcpy(frame, data, len);
+  line_noise(bus, frame, len);
+  flip_bit(frame, len, &dev->flip_next_write);
+
+  if (dev->pec) {
+    uint8_t addr_w = (uint8_t)(addr << 1);
+    if (len < 2 || smart_relay_crc8(smart_relay_crc8(0, &addr_w, 1), frame, (uint8_t)(len - 1)) != frame[len - 1]) {
+      dev->pec_errors++;
+      respond(dev, STATUS_PEC_ERR, 0, 0);
+      return 0;
+    }
+    len--;
+  }
+  execute(dev, frame, len);
+  return 0;
+}
+
+int smart_relay_sim_read(smart_relay_sim_bus_t *bus, uint8_t addr, uint8_t *data, uint8_t len) {
+  if (bus == 0) {
+    return -1;
+  }
+  bus->reads++;
+  smart_relay_sim_advance_us(bus, smart_relay_sim_transfer_us(bus, len));
+  smart_relay_sim_dev_t *dev = smart_relay_sim_find(bus, addr);
+  if (bus_fault(bus) || dev == 0 || asleep(dev)) {
+    bus->nacks++;
+    return -1;
+  }
+  if (bus->abort_reads > 0) {
+    bus->abort_reads--;
+    return -1;
+  }
+  for (uint8_t i = 0; i < len; i++) {
+    // Reads past the prepared response see an idle (pulled-up) bus.
+    data[i] = i < dev->resp_len ? dev->resp[i] : 0xFF;
+  }
+  if (dev->resp_len == 0 && len > 0) {
+    data[0] = STATUS_ERR;
+  }
+  line_noise(bus, data, len);
+  flip_bit(data, len, &dev->flip_next_read);
+  return 0;
+}
+
+void smart_relay_sim_attach(smart_relay_sim_bus_t *bus) {
+  active_bus = bus;
+}
+
+int smart_relay_sim_i2c_write(uint8_t addr, const uint8_t *data, uint8_t len) {
+  return smart_relay_sim_write(active_bus, addr, data, len);
+}
+
+int smart_relay_sim_i2c_read(uint8_t addr, uint8_t *data, uint8_t len) {
+  return smart_relay_sim_read(active_bus, addr, data, len);
+}
+
+void smart_relay_sim_delay_ms(uint16_t ms) {
+  smart_relay_sim_advance(active_bus, ms);
+}
+
+int smart_relay_sim_clock_out(void) {
+  if (active_bus == 0) {
+    return -1;
+  }
+  // Nine SCL pulses and a STOP: ten bit times.
+  smart_relay_sim_advance_us(active_bus, smart_relay_sim_transfer_us(active_bus, 0) / 2);
+  active_bus->sda_stuck = 0;
+  return active_bus->adapter_hung ? -1 : 0;
+}
+
+int smart_relay_sim_bus_reset(void) {
+  if (active_bus == 0) {
+    return -1;
+  }
+  smart_relay_sim_advance_us(active_bus, 1000);
+  active_bus->adapter_hung = 0;
+  return 0;
+}
+
+uint32_t smart_relay_sim_micros(void) {
+  return active_bus != 0 ? (uint32_t)active_bus->now_us : 0;
+}
@@ -0,0 +1,159 @@
+#ifndef SMART_RELAY_SIM_H
+#define SMART_RELAY_SIM_H
+
+#include <stdint.h>
+#include "../smart_relay.h"
+
+// Host-side model of Smart Relay devices on one I2C bus. It speaks the wire
+// protocol from docs/protocol.md behind the smart_relay_t i2c callbacks, so
+// the C library (and anything built on it) can run without hardware.
+//
+//   smart_relay_sim_bus_t bus;
+//   smart_relay_sim_init(&bus);
+//   smart_relay_sim_add(&bus, 0x2A);
+//   smart_relay_sim_attach(&bus);
+//   smart_relay_t relay = { .address = 0x2A,
+//                           .i2c_write = smart_relay_sim_i2c_write,
+//                           .i2c_read = smart_relay_sim_i2c_read,
+//                           .delay_ms = smart_relay_sim_delay_ms };
+//   smart_relay_sim_advance(&bus, 1000);  // virtual time, ms
+
+#define SMART_RELAY_SIM_MAX_DEVICES 112
+#define SMART_RELAY_SIM_MAX_RELAYS 8
+
+// Model defaults (firmware constants are not part of the protocol)
+#define SMART_RELAY_SIM_DEFAULT_RELAYS 4
+#define SMART_RELAY_SIM_DEFAULT_PING_TIMEOUT_SEC 30
+#define SMART_RELAY_SIM_DEFAULT_RESET_SEC 2
+#define SMART_RELAY_SIM_DEFAULT_MAX_ON_SEC 3600
+#define SMART_RELAY_SIM_DEFAULT_OFF_SEC 60
+#define SMART_RELAY_SIM_WD_MAX_BACKOFF 64
+#define SMART_RELAY_SIM_EEPROM_BUSY_US 4000UL
+#define SMART_RELAY_SIM_DEFAULT_CLOCK_HZ 100000UL
+#define SMART_RELAY_SIM_SHIFT_THRESHOLD 90000UL
+
+// Optional protocol features, cleared to emulate older firmware
+#define SMART_RELAY_SIM_FEATURE_PEC (1U << 0)
+#define SMART_RELAY_SIM_FEATURE_GROUPS (1U << 1)
+#define SMART_RELAY_SIM_FEATURE_ALL_STATUS (1U << 2)
+#define SMART_RELAY_SIM_FEATURE_RELAY_MASK (1U << 3)
+#define SMART_RELAY_SIM_FEATURE_PULSE_MS (1U << 4)
+#define SMART_RELAY_SIM_FEATURE_ALL 0xFFFFU
+
+typedef struct {
+  uint8_t address;
+  uint8_t pending_address;
+  uint8_t relay_count;
+  uint16_t features;
+  uint16_t vendor_id;
+  uint16_t product_id;
+  uint8_t revision;
+  uint16_t fw_version;
+  uint8_t eeprom_version;
+
+  uint8_t state_mask;
+  uint8_t init_mask;
+  uint8_t persist;
+  uint8_t timer_mask;
+  uint8_t timer_revert_mask;
+  uint64_t timer_us[SMART_RELAY_SIM_MAX_RELAYS];
+
+  uint8_t wd_enabled;
+  uint8_t wd_relay;
+  uint8_t wd_active_state;
+  uint8_t wd_in_reset;
+  uint8_t wd_backoff;
+  uint16_t wd_timeout_sec;
+  uint16_t wd_reset_sec;
+  uint64_t wd_remaining_us;
+  uint32_t trip_count;
+
+  uint8_t pc_enabled;
+  uint8_t pc_relay;
+  uint8_t pc_sleep_enable;
+  uint8_t pc_off;
+  uint16_t pc_max_on_sec;
+  uint16_t pc_off_sec;
+  uint64_t pc_remaining_us;
+
+  uint32_t eeprom_writes;
+  uint8_t shift_count;
+  uint32_t busy_us;
+  uint32_t eeprom_busy_us;  // BUSY window after each EEPROM write
+
+  uint8_t groups;
+  uint8_t group_seq;
+  uint8_t group_status;
+
+  uint8_t pec;
+  uint16_t pec_errors;
+  uint8_t resp[SMART_RELAY_MAX_RESPONSE + 1];
+  uint8_t resp_len;
+
+  // One-shot fault injection: bit index + 1 to flip in the next frame, 0 = none
+  uint8_t flip_next_write;
+  uint8_t flip_next_read;
+
+  uint32_t commands;
+  uint32_t busy_replies;
+} smart_relay_sim_dev_t;
+
+typedef struct {
+  smart_relay_sim_dev_t devices[SMART_RELAY_SIM_MAX_DEVICES];
+  uint8_t count;
+  uint64_t now_us;
+
+  // Every transfer advances virtual time by its duration at this SCL rate
+  // (0 = transfers take no time; the caller drives the clock).
+  uint32_t clock_hz;
+
+  // Random bit errors on every transferred byte, in parts per million
+  uint32_t bit_error_ppm;
+  uint32_t rng;
+
+  // Bus faults: a slave holding SDA low (cleared by clock_out), a hung
+  // adapter (cleared by bus_reset), a burst of NACKed transfers, and reads
+  // aborted mid-byte after the device already executed the command.
+  uint8_t sda_stuck;
+  uint8_t adapter_hung;
+  uint16_t nack_burst;
+  uint8_t abort_reads;
+
+  uint32_t writes;
+  uint32_t reads;
+  uint32_t nacks;
+  uint32_t bytes;
+} smart_relay_sim_bus_t;
+
+void smart_relay_sim_init(smart_relay_sim_bus_t *bus);
+smart_relay_sim_dev_t *smart_relay_sim_add(smart_relay_sim_bus_t *bus, uint8_t address);
+smart_relay_sim_dev_t *smart_relay_sim_find(smart_relay_sim_bus_t *bus, uint8_t address);
+
+// Power-on reset: volatile state cleared, persisted state restored.
+void smart_relay_sim_device_reset(smart_relay_sim_dev_t *dev);
+
+// Advances virtual time; timers, watchdog and power cycle run on device time.
+void smart_relay_sim_advance(smart_relay_sim_bus_t *bus, uint32_t ms);
+void smart_relay_sim_advance_us(smart_relay_sim_bus_t *bus, uint64_t us);
+void smart_relay_sim_device_advance(smart_relay_sim_dev_t *dev, uint64_t us);
+// Microseconds until the device changes state on its own (UINT64_MAX if idle).
+uint64_t smart_relay_sim_next_event_us(const smart_relay_sim_dev_t *dev);
+// Wire time of one transfer of len data bytes (address byte, ACKs, START/STOP).
+uint32_t smart_relay_sim_transfer_us(const smart_relay_sim_bus_t *bus, uint8_t len);
+
+// Bus transfers; return 0 on ACK, -1 on NACK (same contract as smart_relay_t).
+// Writes to SMART_RELAY_GENERAL_CALL reach every device with group support.
+int smart_relay_sim_write(smart_relay_sim_bus_t *bus, uint8_t addr, const uint8_t *data, uint8_t len);
+int smart_relay_sim_read(smart_relay_sim_bus_t *bus, uint8_t addr, uint8_t *data, uint8_t len);
+
+// smart_relay_t callbacks routed to the attached bus.
+void smart_relay_sim_attach(smart_relay_sim_bus_t *bus);
+int smart_relay_sim_i2c_write(uint8_t addr, const uint8_t *data, uint8_t len);
+int smart_relay_sim_i2c_read(uint8_t addr, uint8_t *data, uint8_t len);
+void smart_relay_sim_delay_ms(uint16_t ms);
+// Recovery hooks: nine SCL pulses + STOP, and an adapter reset.
+int smart_relay_sim_clock_out(void);
+int smart_relay_sim_bus_reset(void);
+uint32_t smart_relay_sim_micros(void);
+
+#endif // SMART_RELAY_SIM_H
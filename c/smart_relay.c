@@ -1,11 +1,37 @@
 #include "smart_relay.h"
 
+static const uint8_t crc8_table[256] = {
+  0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+  0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+  0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+  0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+  0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+  0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+  0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+  0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+  0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+  0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+  0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+  0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+  0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+  0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+  0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+  0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3
+};
+
+uint8_t smart_relay_crc8(uint8_t crc, const uint8_t *data, uint8_t len) {
+  for (uint8_t i = 0; i < len; i++) {
+    crc = crc8_table[crc ^ data[i]];
+  }
+  return crc;
+}
+
 static int send_command(smart_relay_t *dev, uint8_t cmd, const uint8_t *payload, uint8_t payload_len) {
   if (dev == 0 || dev->i2c_write == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
 
-  uint8_t buf[1 + 8];
+  uint8_t buf[1 + 8 + 1];
   uint8_t total_len = 1 + payload_len;
   if (payload_len > 8) {
     return SMART_RELAY_ERR_PARAM;
@@ -15,6 +41,12 @@ static int send_command(smart_relay_t *dev, uint8_t cmd, const uint8_t *payload,
   for (uint8_t i = 0; i < payload_len; i++) {
     buf[1 + i] = payload[i];
   }
+  if (dev->pec) {
+    // PEC covers the write address byte, command and payload.
+    uint8_t addr_w = (uint8_t)(dev->address << 1);
+    buf[total_len] = smart_relay_crc8(smart_relay_crc8(0, &addr_w, 1), buf, total_len);
+    total_len++;
+  }
 
   int ret = dev->i2c_write(dev->address, buf, total_len);
   if (ret != 0) {
@@ -23,15 +55,50 @@ static int send_command(smart_relay_t *dev, uint8_t cmd, const uint8_t *payload,
   return SMART_RELAY_OK;
 }
 
+// Reads a len-byte response (status + data) and strips/verifies the PEC byte.
+static int read_response(smart_relay_t *dev, uint8_t *buf, uint8_t len) {
+  if (dev == 0 || dev->i2c_read == 0 || len > SMART_RELAY_MAX_RESPONSE) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  if (!dev->pec) {
+    return dev->i2c_read(dev->address, buf, len) == 0 ? SMART_RELAY_OK : SMART_RELAY_ERR_IO;
+  }
+
+  uint8_t raw[SMART_RELAY_MAX_RESPONSE + 1];
+  if (dev->i2c_read(dev->address, raw, (uint8_t)(len + 1)) != 0) {
+    return SMART_RELAY_ERR_IO;
+  }
+  if (raw[0] != STATUS_OK) {
+    // Error replies carry no data: status + PEC only.
+    len = 1;
+  }
+  uint8_t addr_r = (uint8_t)((dev->address << 1) | 1);
+  if (smart_relay_crc8(smart_relay_crc8(0, &addr_r, 1), raw, len) != raw[len]) {
+    dev->pec_errors++;
+    return SMART_RELAY_ERR_PEC;
+  }
+  if (raw[0] == STATUS_PEC_ERR) {
+    dev->pec_errors++;
+    return SMART_RELAY_ERR_PEC;
+  }
+  for (uint8_t i = 0; i < len; i++) {
+    buf[i] = raw[i];
+  }
+  return SMART_RELAY_OK;
+}
+
 static int read_status(smart_relay_t *dev) {
   if (dev == 0 || dev->i2c_read == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
 
   uint8_t status = 0;
-  int ret = dev->i2c_read(dev->address, &status, 1);
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
+  int ret = read_response(dev, &status, 1);
+  if (ret != SMART_RELAY_OK) {
+    return ret;
+  }
+  if (status == STATUS_BUSY) {
+    return SMART_RELAY_ERR_BUSY;
   }
   if (status != STATUS_OK) {
     return SMART_RELAY_ERR_STATUS;
@@ -39,65 +106,222 @@ static int read_status(smart_relay_t *dev) {
   return SMART_RELAY_OK;
 }
 
+// Maps the status byte of a data response like read_status() does.
+static int response_status(uint8_t status) {
+  if (status == STATUS_BUSY) {
+    return SMART_RELAY_ERR_BUSY;
+  }
+  return status == STATUS_OK ? SMART_RELAY_OK : SMART_RELAY_ERR_STATUS;
+}
+
+// One command/response exchange; buf == 0 means a status-only reply.
+static int exchange(smart_relay_t *dev, uint8_t cmd, const uint8_t *payload, uint8_t payload_len, uint8_t *buf,
+                    uint8_t len) {
+  int ret = send_command(dev, cmd, payload, payload_len);
+  if (ret != SMART_RELAY_OK) return ret;
+  return buf == 0 ? read_status(dev) : read_response(dev, buf, len);
+}
+
+enum {
+  FLIGHT_FREE = 0,
+  FLIGHT_QUEUED,
+  FLIGHT_RUNNING,
+  FLIGHT_DONE
+};
+
+// Waits for the device to go idle and claims it; called with the lock held.
+static void acquire(smart_relay_sync_t *sync) {
+  while (sync->busy) {
+    sync->wait(sync->ctx);
+  }
+  sync->busy = 1;
+  sync->transactions++;
+}
+
+// Releases the device and wakes all waiters; called with the lock held.
+static void release(smart_relay_sync_t *sync) {
+  sync->busy = 0;
+  sync->notify_all(sync->ctx);
+}
+
+// Flights are keyed by command and response length: a status-only probe of
+// a read command must not hand its one byte to a full-length reader.
+static smart_relay_flight_t *find_flight(smart_relay_sync_t *sync, uint8_t cmd, uint8_t len, uint8_t state) {
+  for (uint8_t i = 0; i < SMART_RELAY_SYNC_FLIGHTS; i++) {
+    smart_relay_flight_t *flight = &sync->flights[i];
+    if (flight->state == state && (state == FLIGHT_FREE || (flight->cmd == cmd && flight->len == len))) {
+      return flight;
+    }
+  }
+  return 0;
+}
+
+static void copy_result(const smart_relay_flight_t *flight, uint8_t *buf, uint8_t len) {
+  for (uint8_t i = 0; i < len; i++) {
+    buf[i] = flight->data[i];
+  }
+}
+
+// Runs an exchange under dev->sync when attached. Argument-free reads join a
+// queued flight for the same command instead of issuing their own: the
+// flight has not started yet, so its result is no older than the caller.
+static int transact(smart_relay_t *dev, uint8_t cmd, const uint8_t *payload, uint8_t payload_len, uint8_t *buf,
+                    uint8_t len) {
+  if (dev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  smart_relay_sync_t *sync = dev->sync;
+  if (sync == 0) {
+    return exchange(dev, cmd, payload, payload_len, buf, len);
+  }
+
+  sync->lock(sync->ctx);
+  smart_relay_flight_t *flight = 0;
+  if (buf != 0 && payload_len == 0 && len <= SMART_RELAY_MAX_RESPONSE) {
+    flight = find_flight(sync, cmd, len, FLIGHT_QUEUED);
+    if (flight != 0) {
+      flight->waiters++;
+      sync->coalesced++;
+      while (flight->state != FLIGHT_DONE) {
+        sync->wait(sync->ctx);
+      }
+      int ret = flight->ret;
+      copy_result(flight, buf, len);
+      if (--flight->waiters == 0) {
+        flight->state = FLIGHT_FREE;
+      }
+      sync->unlock(sync->ctx);
+      return ret;
+    }
+    // No free slot just means this read is not shared.
+    flight = find_flight(sync, cmd, len, FLIGHT_FREE);
+    if (flight != 0) {
+      flight->cmd = cmd;
+      flight->len = len;
+      flight->state = FLIGHT_QUEUED;
+      flight->waiters = 0;
+    }
+  }
+  acquire(sync);
+  if (flight != 0) {
+    flight->state = FLIGHT_RUNNING;
+  }
+  sync->unlock(sync->ctx);
+
+  int ret = exchange(dev, cmd, payload, payload_len, buf, len);
+
+  sync->lock(sync->ctx);
+  if (flight != 0) {
+    flight->ret = ret;
+    for (uint8_t i = 0; i < len; i++) {
+      flight->data[i] = buf[i];
+    }
+    flight->state = flight->waiters ? FLIGHT_DONE : FLIGHT_FREE;
+  }
+  release(sync);
+  sync->unlock(sync->ctx);
+  return ret;
+}
+
+void smart_relay_sync_init(smart_relay_sync_t *sync, void *ctx, void (*lock)(void *ctx), void (*unlock)(void *ctx),
+                           void (*wait)(void *ctx), void (*notify_all)(void *ctx)) {
+  if (sync == 0) {
+    return;
+  }
+  sync->ctx = ctx;
+  sync->lock = lock;
+  sync->unlock = unlock;
+  sync->wait = wait;
+  sync->notify_all = notify_all;
+  sync->busy = 0;
+  sync->transactions = 0;
+  sync->coalesced = 0;
+  for (uint8_t i = 0; i < SMART_RELAY_SYNC_FLIGHTS; i++) {
+    sync->flights[i].state = FLIGHT_FREE;
+    sync->flights[i].waiters = 0;
+  }
+}
+
 int smart_relay_relay_on(smart_relay_t *dev, uint8_t relay_id) {
   uint8_t payload[1] = { relay_id };
-  int ret = send_command(dev, CMD_RELAY_ON, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_RELAY_ON, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_relay_off(smart_relay_t *dev, uint8_t relay_id) {
   uint8_t payload[1] = { relay_id };
-  int ret = send_command(dev, CMD_RELAY_OFF, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
+  return transact(dev, CMD_RELAY_OFF, payload, sizeof(payload), 0, 0);
+}
+
+int smart_relay_relay_set_mask(smart_relay_t *dev, uint8_t relay_mask, uint8_t state_mask) {
+  uint8_t payload[2] = { relay_mask, state_mask };
+  return transact(dev, CMD_RELAY_SET_MASK, payload, sizeof(payload), 0, 0);
+}
+
+int smart_relay_relay_set_mask_send(smart_relay_t *dev, uint8_t relay_mask, uint8_t state_mask) {
+  if (dev == 0 || dev->sync != 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  uint8_t payload[2] = { relay_mask, state_mask };
+  return send_command(dev, CMD_RELAY_SET_MASK, payload, sizeof(payload));
+}
+
+int smart_relay_read_pending(smart_relay_t *dev) {
+  if (dev == 0 || dev->sync != 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
   return read_status(dev);
 }
 
 int smart_relay_relay_on_for(smart_relay_t *dev, uint8_t relay_id, uint16_t duration_sec) {
   uint8_t payload[3] = { relay_id, (uint8_t)(duration_sec & 0xFF), (uint8_t)((duration_sec >> 8) & 0xFF) };
-  int ret = send_command(dev, CMD_RELAY_ON_FOR, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_RELAY_ON_FOR, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_relay_off_for(smart_relay_t *dev, uint8_t relay_id, uint16_t duration_sec) {
   uint8_t payload[3] = { relay_id, (uint8_t)(duration_sec & 0xFF), (uint8_t)((duration_sec >> 8) & 0xFF) };
-  int ret = send_command(dev, CMD_RELAY_OFF_FOR, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_RELAY_OFF_FOR, payload, sizeof(payload), 0, 0);
+}
+
+int smart_relay_relay_on_for_ms(smart_relay_t *dev, uint8_t relay_id, uint16_t duration_ms) {
+  uint8_t payload[3] = { relay_id, (uint8_t)(duration_ms & 0xFF), (uint8_t)((duration_ms >> 8) & 0xFF) };
+  return transact(dev, CMD_RELAY_ON_FOR_MS, payload, sizeof(payload), 0, 0);
+}
+
+int smart_relay_relay_off_for_ms(smart_relay_t *dev, uint8_t relay_id, uint16_t duration_ms) {
+  uint8_t payload[3] = { relay_id, (uint8_t)(duration_ms & 0xFF), (uint8_t)((duration_ms >> 8) & 0xFF) };
+  return transact(dev, CMD_RELAY_OFF_FOR_MS, payload, sizeof(payload), 0, 0);
+}
+
+int smart_relay_command_status(smart_relay_t *dev, uint8_t cmd, const uint8_t *payload, uint8_t payload_len,
+                               uint8_t *out_status) {
+  if (out_status == 0 || (payload_len > 0 && payload == 0)) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  // A one-byte response read returns the status byte as is.
+  return transact(dev, cmd, payload, payload_len, out_status, 1);
 }
 
 int smart_relay_watchdog_enable(smart_relay_t *dev, uint8_t relay_id) {
   uint8_t payload[1] = { relay_id };
-  int ret = send_command(dev, CMD_WATCHDOG_ENABLE, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_WATCHDOG_ENABLE, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_watchdog_disable(smart_relay_t *dev) {
-  int ret = send_command(dev, CMD_WATCHDOG_DISABLE, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_WATCHDOG_DISABLE, 0, 0, 0, 0);
 }
 
 int smart_relay_watchdog_ping(smart_relay_t *dev) {
-  int ret = send_command(dev, CMD_WATCHDOG_PING, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_WATCHDOG_PING, 0, 0, 0, 0);
 }
 
 int smart_relay_watchdog_set_ping_timeout(smart_relay_t *dev, uint16_t timeout_sec) {
   uint8_t payload[2] = { (uint8_t)(timeout_sec & 0xFF), (uint8_t)((timeout_sec >> 8) & 0xFF) };
-  int ret = send_command(dev, CMD_WATCHDOG_SET_PING_TIMEOUT, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_WATCHDOG_SET_PING_TIMEOUT, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_watchdog_set_reset_duration(smart_relay_t *dev, uint16_t duration_sec) {
   uint8_t payload[2] = { (uint8_t)(duration_sec & 0xFF), (uint8_t)((duration_sec >> 8) & 0xFF) };
-  int ret = send_command(dev, CMD_WATCHDOG_SET_RESET_DURATION, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_WATCHDOG_SET_RESET_DURATION, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_watchdog_set_reset_active_state(smart_relay_t *dev, uint8_t active_state) {
@@ -105,29 +329,18 @@ int smart_relay_watchdog_set_reset_active_state(smart_relay_t *dev, uint8_t acti
     return SMART_RELAY_ERR_PARAM;
   }
   uint8_t payload[1] = { active_state };
-  int ret = send_command(dev, CMD_WATCHDOG_SET_RESET_ACTIVE_STATE, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_WATCHDOG_SET_RESET_ACTIVE_STATE, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_watchdog_get_reset_active_state(smart_relay_t *dev, uint8_t *out_active_state) {
   if (out_active_state == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_WATCHDOG_GET_RESET_ACTIVE_STATE, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-
   uint8_t buf[2];
-  if (dev == 0 || dev->i2c_read == 0) {
-    return SMART_RELAY_ERR_PARAM;
-  }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
-  }
-  if (buf[0] != STATUS_OK) {
-    return SMART_RELAY_ERR_STATUS;
-  }
+  int ret = transact(dev, CMD_WATCHDOG_GET_RESET_ACTIVE_STATE, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
   *out_active_state = buf[1] ? 1 : 0;
   return SMART_RELAY_OK;
 }
@@ -136,20 +349,11 @@ int smart_relay_watchdog_get_trip_count(smart_relay_t *dev, uint32_t *out_count)
   if (out_count == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_WATCHDOG_GET_TRIP_COUNT, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-
   uint8_t buf[5];
-  if (dev == 0 || dev->i2c_read == 0) {
-    return SMART_RELAY_ERR_PARAM;
-  }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
-  }
-  if (buf[0] != STATUS_OK) {
-    return SMART_RELAY_ERR_STATUS;
-  }
+  int ret = transact(dev, CMD_WATCHDOG_GET_TRIP_COUNT, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
 
   *out_count = (uint32_t)buf[1] |
                ((uint32_t)buf[2] << 8) |
@@ -159,15 +363,11 @@ int smart_relay_watchdog_get_trip_count(smart_relay_t *dev, uint32_t *out_count)
 }
 
 int smart_relay_watchdog_clear_trip_count(smart_relay_t *dev) {
-  int ret = send_command(dev, CMD_WATCHDOG_CLEAR_TRIP_COUNT, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_WATCHDOG_CLEAR_TRIP_COUNT, 0, 0, 0, 0);
 }
 
 int smart_relay_eeprom_clear(smart_relay_t *dev) {
-  int ret = send_command(dev, CMD_EEPROM_CLEAR, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_EEPROM_CLEAR, 0, 0, 0, 0);
 }
 
 int smart_relay_power_cycle_enable(smart_relay_t *dev, uint8_t relay_id) {
@@ -177,61 +377,40 @@ int smart_relay_power_cycle_enable(smart_relay_t *dev, uint8_t relay_id) {
 int smart_relay_power_cycle_enable_ex(smart_relay_t *dev, uint8_t relay_id, uint8_t sleep_enable) {
   uint8_t payload[2] = { relay_id, sleep_enable ? 1 : 0 };
   uint8_t payload_len = sleep_enable ? 2 : 1;
-  int ret = send_command(dev, CMD_POWER_CYCLE_ENABLE, payload, payload_len);
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_POWER_CYCLE_ENABLE, payload, payload_len, 0, 0);
 }
 
 int smart_relay_power_cycle_disable(smart_relay_t *dev) {
-  int ret = send_command(dev, CMD_POWER_CYCLE_DISABLE, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_POWER_CYCLE_DISABLE, 0, 0, 0, 0);
 }
 
 int smart_relay_power_cycle_set_max_on_time(smart_relay_t *dev, uint16_t max_on_sec) {
   uint8_t payload[2] = { (uint8_t)(max_on_sec & 0xFF), (uint8_t)((max_on_sec >> 8) & 0xFF) };
-  int ret = send_command(dev, CMD_POWER_CYCLE_SET_MAX_ON_TIME, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_POWER_CYCLE_SET_MAX_ON_TIME, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_power_cycle_sleep(smart_relay_t *dev, uint16_t off_sec) {
   uint8_t payload[2] = { (uint8_t)(off_sec & 0xFF), (uint8_t)((off_sec >> 8) & 0xFF) };
-  int ret = send_command(dev, CMD_POWER_CYCLE_SLEEP, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_POWER_CYCLE_SLEEP, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_relay_state_persist_enable(smart_relay_t *dev) {
-  int ret = send_command(dev, CMD_RELAY_STATE_PERSIST_ENABLE, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_RELAY_STATE_PERSIST_ENABLE, 0, 0, 0, 0);
 }
 
 int smart_relay_relay_state_persist_disable(smart_relay_t *dev) {
-  int ret = send_command(dev, CMD_RELAY_STATE_PERSIST_DISABLE, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_RELAY_STATE_PERSIST_DISABLE, 0, 0, 0, 0);
 }
 
 int smart_relay_relay_state_persist_get(smart_relay_t *dev, uint8_t *out_enabled) {
   if (out_enabled == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_RELAY_STATE_PERSIST_GET, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-
   uint8_t buf[2];
-  if (dev == 0 || dev->i2c_read == 0) {
-    return SMART_RELAY_ERR_PARAM;
-  }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
-  }
-  if (buf[0] != STATUS_OK) {
-    return SMART_RELAY_ERR_STATUS;
-  }
+  int ret = transact(dev, CMD_RELAY_STATE_PERSIST_GET, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
   *out_enabled = buf[1];
   return SMART_RELAY_OK;
 }
@@ -240,20 +419,11 @@ int smart_relay_relay_get_state(smart_relay_t *dev, uint8_t *out_state_mask, uin
   if (out_state_mask == 0 || out_init_mask == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_RELAY_GET_STATE, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-
   uint8_t buf[3];
-  if (dev == 0 || dev->i2c_read == 0) {
-    return SMART_RELAY_ERR_PARAM;
-  }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
-  }
-  if (buf[0] != STATUS_OK) {
-    return SMART_RELAY_ERR_STATUS;
-  }
+  int ret = transact(dev, CMD_RELAY_GET_STATE, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
   *out_state_mask = buf[1];
   *out_init_mask = buf[2];
   return SMART_RELAY_OK;
@@ -261,29 +431,18 @@ int smart_relay_relay_get_state(smart_relay_t *dev, uint8_t *out_state_mask, uin
 
 int smart_relay_i2c_set_address(smart_relay_t *dev, uint8_t new_address) {
   uint8_t payload[1] = { new_address };
-  int ret = send_command(dev, CMD_I2C_SET_ADDRESS, payload, sizeof(payload));
-  if (ret != SMART_RELAY_OK) return ret;
-  return read_status(dev);
+  return transact(dev, CMD_I2C_SET_ADDRESS, payload, sizeof(payload), 0, 0);
 }
 
 int smart_relay_eeprom_get_write_count(smart_relay_t *dev, uint32_t *out_count) {
   if (out_count == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_EEPROM_GET_WRITE_COUNT, 0, 0);
-  if (ret != SMART_RELAY_OK) return ret;
-
   uint8_t buf[5];
-  if (dev == 0 || dev->i2c_read == 0) {
-    return SMART_RELAY_ERR_PARAM;
-  }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
-  }
-  if (buf[0] != STATUS_OK) {
-    return SMART_RELAY_ERR_STATUS;
-  }
+  int ret = transact(dev, CMD_EEPROM_GET_WRITE_COUNT, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
   *out_count = (uint32_t)buf[1] |
                ((uint32_t)buf[2] << 8) |
                ((uint32_t)buf[3] << 16) |
@@ -295,90 +454,329 @@ int smart_relay_eeprom_get_shift_count(smart_relay_t *dev, uint8_t *out_count) {
   if (out_count == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_EEPROM_GET_SHIFT_COUNT, 0, 0);
+  uint8_t buf[2];
+  int ret = transact(dev, CMD_EEPROM_GET_SHIFT_COUNT, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
   if (ret != SMART_RELAY_OK) return ret;
+  *out_count = buf[1];
+  return SMART_RELAY_OK;
+}
 
-  uint8_t buf[2];
-  if (dev == 0 || dev->i2c_read == 0) {
+int smart_relay_firmware_get_version(smart_relay_t *dev, uint16_t *out_version) {
+  if (out_version == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
-  }
-  if (buf[0] != STATUS_OK) {
-    return SMART_RELAY_ERR_STATUS;
-  }
-  *out_count = buf[1];
+  uint8_t buf[3];
+  int ret = transact(dev, CMD_FIRMWARE_GET_VERSION, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
+  *out_version = (uint16_t)buf[1] | ((uint16_t)buf[2] << 8);
   return SMART_RELAY_OK;
 }
 
-int smart_relay_firmware_get_version(smart_relay_t *dev, uint16_t *out_version) {
+int smart_relay_eeprom_get_version(smart_relay_t *dev, uint8_t *out_version) {
   if (out_version == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_FIRMWARE_GET_VERSION, 0, 0);
+  uint8_t buf[2];
+  int ret = transact(dev, CMD_EEPROM_GET_VERSION, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
   if (ret != SMART_RELAY_OK) return ret;
+  *out_version = buf[1];
+  return SMART_RELAY_OK;
+}
 
-  uint8_t buf[3];
-  if (dev == 0 || dev->i2c_read == 0) {
+int smart_relay_device_info(smart_relay_t *dev, uint16_t *out_vendor_id, uint16_t *out_product_id,
+                            uint8_t *out_revision, uint16_t *out_fw_version) {
+  if (out_vendor_id == 0 || out_product_id == 0 || out_revision == 0 || out_fw_version == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
+  uint8_t buf[8];
+  int ret = transact(dev, CMD_DEVICE_INFO, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
+  *out_vendor_id = (uint16_t)buf[1] | ((uint16_t)buf[2] << 8);
+  *out_product_id = (uint16_t)buf[3] | ((uint16_t)buf[4] << 8);
+  *out_revision = buf[5];
+  *out_fw_version = (uint16_t)buf[6] | ((uint16_t)buf[7] << 8);
+  return SMART_RELAY_OK;
+}
+
+int smart_relay_status_decode(const uint8_t *block, uint8_t len, smart_relay_status_t *out_status) {
+  if (block == 0 || out_status == 0) {
+    return SMART_RELAY_ERR_PARAM;
   }
-  if (buf[0] != STATUS_OK) {
+  if (len < SMART_RELAY_STATUS_LEN || block[0] < SMART_RELAY_STATUS_VERSION || block[1] < SMART_RELAY_STATUS_LEN) {
     return SMART_RELAY_ERR_STATUS;
   }
-  *out_version = (uint16_t)buf[1] | ((uint16_t)buf[2] << 8);
+  out_status->version = block[0];
+  out_status->state_mask = block[2];
+  out_status->init_mask = block[3];
+  out_status->flags = block[4];
+  out_status->mode = block[5];
+  out_status->mode_relay = block[6];
+  out_status->shift_count = block[7];
+  out_status->trip_count = (uint32_t)block[8] |
+                           ((uint32_t)block[9] << 8) |
+                           ((uint32_t)block[10] << 16) |
+                           ((uint32_t)block[11] << 24);
+  out_status->eeprom_write_count = (uint32_t)block[12] |
+                                   ((uint32_t)block[13] << 8) |
+                                   ((uint32_t)block[14] << 16) |
+                                   ((uint32_t)block[15] << 24);
+  out_status->wd_remaining_sec = (uint16_t)block[16] | ((uint16_t)block[17] << 8);
+  out_status->pc_remaining_sec = (uint16_t)block[18] | ((uint16_t)block[19] << 8);
+  out_status->timer_mask = block[20];
+  out_status->next_timer_sec = (uint16_t)block[21] | ((uint16_t)block[22] << 8);
   return SMART_RELAY_OK;
 }
 
-int smart_relay_eeprom_get_version(smart_relay_t *dev, uint8_t *out_version) {
-  if (out_version == 0) {
+int smart_relay_get_all_status(smart_relay_t *dev, smart_relay_status_t *out_status) {
+  if (out_status == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_EEPROM_GET_VERSION, 0, 0);
+  uint8_t payload[1] = { SMART_RELAY_STATUS_LEN };
+  uint8_t buf[1 + SMART_RELAY_STATUS_LEN];
+  int ret = transact(dev, CMD_GET_ALL_STATUS, payload, sizeof(payload), buf, sizeof(buf));
   if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
+  return smart_relay_status_decode(buf + 1, SMART_RELAY_STATUS_LEN, out_status);
+}
 
-  uint8_t buf[2];
-  if (dev == 0 || dev->i2c_read == 0) {
+int smart_relay_group_set(smart_relay_t *dev, uint8_t group_mask) {
+  uint8_t payload[1] = { group_mask };
+  return transact(dev, CMD_GROUP_SET, payload, sizeof(payload), 0, 0);
+}
+
+int smart_relay_group_get(smart_relay_t *dev, uint8_t *out_group_mask, uint8_t *out_last_seq,
+                          uint8_t *out_last_status) {
+  if (out_group_mask == 0 || out_last_seq == 0 || out_last_status == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
-  }
-  if (buf[0] != STATUS_OK) {
-    return SMART_RELAY_ERR_STATUS;
-  }
-  *out_version = buf[1];
+  uint8_t buf[4];
+  int ret = transact(dev, CMD_GROUP_GET, 0, 0, buf, sizeof(buf));
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = response_status(buf[0]);
+  if (ret != SMART_RELAY_OK) return ret;
+  *out_group_mask = buf[1];
+  *out_last_seq = buf[2];
+  *out_last_status = buf[3];
   return SMART_RELAY_OK;
 }
 
-int smart_relay_device_info(smart_relay_t *dev, uint16_t *out_vendor_id, uint16_t *out_product_id,
-                            uint8_t *out_revision, uint16_t *out_fw_version) {
-  if (out_vendor_id == 0 || out_product_id == 0 || out_revision == 0 || out_fw_version == 0) {
+int smart_relay_group_relay_set(const smart_relay_t *bus, uint8_t group_mask, uint8_t relay_mask, uint8_t state_mask,
+                                uint8_t seq) {
+  if (bus == 0 || bus->i2c_write == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  int ret = send_command(dev, CMD_DEVICE_INFO, 0, 0);
+  // Broadcasts get no addressed reply, so they always carry a PEC.
+  uint8_t addr_w = (uint8_t)(SMART_RELAY_GENERAL_CALL << 1);
+  uint8_t frame[6] = { CMD_GROUP_RELAY_SET, group_mask, relay_mask, state_mask, seq, 0 };
+  frame[5] = smart_relay_crc8(smart_relay_crc8(0, &addr_w, 1), frame, 5);
+  return bus->i2c_write(SMART_RELAY_GENERAL_CALL, frame, sizeof(frame)) == 0 ? SMART_RELAY_OK : SMART_RELAY_ERR_IO;
+}
+
+static int group_confirm_one(smart_relay_t *dev, uint8_t seq) {
+  smart_relay_sync_t *sync = dev->sync;
+  if (sync != 0) {
+    sync->lock(sync->ctx);
+    acquire(sync);
+    sync->unlock(sync->ctx);
+  }
+  uint8_t buf[3];
+  int ret = read_response(dev, buf, sizeof(buf));
+  if (sync != 0) {
+    sync->lock(sync->ctx);
+    release(sync);
+    sync->unlock(sync->ctx);
+  }
+  // ~seq keeps bus padding (0xFF) after a shorter reply from passing as seq.
+  if (ret == SMART_RELAY_OK && buf[0] == STATUS_OK && buf[1] == seq && (uint8_t)(buf[1] ^ buf[2]) == 0xFF) {
+    return SMART_RELAY_OK;
+  }
+
+  // The pending reply may have been replaced by another command; ask directly.
+  uint8_t group_mask = 0;
+  uint8_t last_seq = 0;
+  uint8_t last_status = 0;
+  ret = smart_relay_group_get(dev, &group_mask, &last_seq, &last_status);
   if (ret != SMART_RELAY_OK) return ret;
+  if (last_seq != seq) {
+    return SMART_RELAY_ERR_VERIFY;
+  }
+  if (last_status == STATUS_BUSY) {
+    return SMART_RELAY_ERR_BUSY;
+  }
+  return last_status == STATUS_OK ? SMART_RELAY_OK : SMART_RELAY_ERR_STATUS;
+}
 
-  uint8_t buf[8];
-  if (dev == 0 || dev->i2c_read == 0) {
+uint8_t smart_relay_group_confirm(smart_relay_t *const *members, uint8_t count, uint8_t seq, int *out_results) {
+  uint8_t failed = 0;
+  if (members == 0) {
+    return count;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    int ret = members[i] != 0 ? group_confirm_one(members[i], seq) : SMART_RELAY_ERR_PARAM;
+    if (out_results != 0) {
+      out_results[i] = ret;
+    }
+    if (ret != SMART_RELAY_OK) {
+      failed++;
+    }
+  }
+  return failed;
+}
+
+static void heartbeat_encode(smart_relay_heartbeat_t *hb) {
+  uint8_t addr_w = (uint8_t)(hb->dev->address << 1);
+  hb->frame[0] = CMD_WATCHDOG_PING;
+  hb->frame[1] = smart_relay_crc8(smart_relay_crc8(0, &addr_w, 1), hb->frame, 1);
+  hb->frame_address = hb->dev->address;
+}
+
+void smart_relay_heartbeat_init(smart_relay_heartbeat_t *hb, smart_relay_t *dev, uint8_t verify_every) {
+  if (hb == 0) {
+    return;
+  }
+  hb->dev = dev;
+  hb->verify_every = verify_every;
+  hb->since_verify = 0;
+  hb->sent = 0;
+  hb->unverified = 0;
+  hb->nacks = 0;
+  hb->failures = 0;
+  if (dev != 0) {
+    heartbeat_encode(hb);
+  }
+}
+
+int smart_relay_heartbeat_ping(smart_relay_heartbeat_t *hb) {
+  if (hb == 0 || hb->dev == 0 || hb->dev->i2c_write == 0) {
     return SMART_RELAY_ERR_PARAM;
   }
-  ret = dev->i2c_read(dev->address, buf, sizeof(buf));
-  if (ret != 0) {
-    return SMART_RELAY_ERR_IO;
+  smart_relay_t *dev = hb->dev;
+  if (hb->frame_address != dev->address) {
+    heartbeat_encode(hb);
   }
-  if (buf[0] != STATUS_OK) {
-    return SMART_RELAY_ERR_STATUS;
+  smart_relay_sync_t *sync = dev->sync;
+  if (sync != 0) {
+    sync->lock(sync->ctx);
+    acquire(sync);
+    sync->unlock(sync->ctx);
   }
-  *out_vendor_id = (uint16_t)buf[1] | ((uint16_t)buf[2] << 8);
-  *out_product_id = (uint16_t)buf[3] | ((uint16_t)buf[4] << 8);
-  *out_revision = buf[5];
-  *out_fw_version = (uint16_t)buf[6] | ((uint16_t)buf[7] << 8);
-  return SMART_RELAY_OK;
+
+  int ret;
+  hb->sent++;
+  if (dev->i2c_write(dev->address, hb->frame, (uint8_t)(dev->pec ? 2 : 1)) != 0) {
+    hb->nacks++;
+    hb->since_verify = 0;
+    ret = exchange(dev, CMD_WATCHDOG_PING, 0, 0, 0, 0);
+  } else if (hb->verify_every != 0 && ++hb->since_verify >= hb->verify_every) {
+    hb->since_verify = 0;
+    ret = read_status(dev);
+  } else {
+    hb->unverified++;
+    ret = SMART_RELAY_OK;
+  }
+  if (ret != SMART_RELAY_OK) {
+    hb->failures++;
+  }
+
+  if (sync != 0) {
+    sync->lock(sync->ctx);
+    release(sync);
+    sync->unlock(sync->ctx);
+  }
+  return ret;
+}
+
+uint8_t smart_relay_heartbeat_ping_all(smart_relay_heartbeat_t *hbs, uint8_t count) {
+  uint8_t failed = 0;
+  if (hbs == 0) {
+    return 0;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (hbs[i].sent == 0 && hbs[i].verify_every != 0) {
+      // Stagger verification so each batch reads back about count/N statuses.
+      hbs[i].since_verify = (uint8_t)(i % hbs[i].verify_every);
+    }
+    if (smart_relay_heartbeat_ping(&hbs[i]) != SMART_RELAY_OK) {
+      failed++;
+    }
+  }
+  return failed;
+}
+
+// Switches framing and dev->pec as one step so no other caller sees a
+// handle whose framing disagrees with the device.
+static int pec_set(smart_relay_t *dev, uint8_t enable) {
+  if (dev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  smart_relay_sync_t *sync = dev->sync;
+  if (sync != 0) {
+    sync->lock(sync->ctx);
+    acquire(sync);
+    sync->unlock(sync->ctx);
+  }
+  uint8_t payload[1] = { enable };
+  // The reply is still framed in the mode the command was sent in.
+  int ret = exchange(dev, CMD_PEC_SET, payload, sizeof(payload), 0, 0);
+  if (ret == SMART_RELAY_OK) {
+    dev->pec = enable;
+  }
+  if (sync != 0) {
+    sync->lock(sync->ctx);
+    release(sync);
+    sync->unlock(sync->ctx);
+  }
+  return ret;
+}
+
+int smart_relay_pec_enable(smart_relay_t *dev) {
+  return pec_set(dev, 1);
+}
+
+int smart_relay_pec_disable(smart_relay_t *dev) {
+  return pec_set(dev, 0);
+}
+
+int smart_relay_pec_resync(smart_relay_t *dev) {
+  if (dev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  smart_relay_sync_t *sync = dev->sync;
+  if (sync != 0) {
+    sync->lock(sync->ctx);
+    acquire(sync);
+    sync->unlock(sync->ctx);
+  }
+  int ret = SMART_RELAY_ERR_PARAM;
+  if (dev->pec) {
+    uint8_t buf[3];
+    dev->pec = 0;
+    ret = exchange(dev, CMD_RELAY_GET_STATE, 0, 0, buf, sizeof(buf));
+    if (ret == SMART_RELAY_OK && buf[0] != STATUS_OK) {
+      // Still speaking PEC (it rejects the plain frame with PEC_ERR): the
+      // CRC failure was the bus, not a reset.
+      ret = SMART_RELAY_ERR_PEC;
+    }
+    if (ret == SMART_RELAY_OK) {
+      uint8_t payload[1] = { 1 };
+      ret = exchange(dev, CMD_PEC_SET, payload, sizeof(payload), 0, 0);
+    }
+    // PEC stays on for the host either way; a failed attempt can be repeated.
+    dev->pec = 1;
+  }
+  if (sync != 0) {
+    sync->lock(sync->ctx);
+    release(sync);
+    sync->unlock(sync->ctx);
+  }
+  return ret;
 }
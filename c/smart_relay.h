@@ -36,16 +36,28 @@ enum {
   CMD_EEPROM_GET_SHIFT_COUNT = 0x19,
   CMD_FIRMWARE_GET_VERSION = 0x1A,
   CMD_EEPROM_GET_VERSION = 0x1B,
-  CMD_DEVICE_INFO = 0x1C
+  CMD_DEVICE_INFO = 0x1C,
+  CMD_PEC_SET = 0x1D,
+  CMD_GROUP_SET = 0x1E,
+  CMD_GROUP_GET = 0x1F,
+  CMD_GROUP_RELAY_SET = 0x20,  // general call only
+  CMD_GET_ALL_STATUS = 0x21,
+  CMD_RELAY_SET_MASK = 0x22,
+  CMD_RELAY_ON_FOR_MS = 0x23,
+  CMD_RELAY_OFF_FOR_MS = 0x24
 };
 
+// I2C general-call address used for group broadcasts
+#define SMART_RELAY_GENERAL_CALL 0x00
+
 // Status codes
 enum {
   STATUS_OK = 0x00,
   STATUS_ERR = 0x01,
   STATUS_BAD_CMD = 0x02,
   STATUS_BAD_PARAM = 0x03,
-  STATUS_BUSY = 0x04
+  STATUS_BUSY = 0x04,
+  STATUS_PEC_ERR = 0x05
 };
 
 // Return codes for the C API
@@ -53,17 +65,110 @@ enum {
 #define SMART_RELAY_ERR_IO -1
 #define SMART_RELAY_ERR_STATUS -2
 #define SMART_RELAY_ERR_PARAM -3
+#define SMART_RELAY_ERR_BUSY -4    // device answered STATUS_BUSY; safe to retry
+#define SMART_RELAY_ERR_VERIFY -5  // readback did not match the written value
+#define SMART_RELAY_ERR_PEC -6     // response failed its CRC-8 check, or device rejected ours
+
+// Largest response frame (status + data), excluding PEC: Get All Status
+#define SMART_RELAY_MAX_RESPONSE 24
+
+// Operating modes
+enum {
+  SMART_RELAY_MODE_NONE = 0,
+  SMART_RELAY_MODE_WATCHDOG = 1,
+  SMART_RELAY_MODE_POWER_CYCLE = 2
+};
+
+// Get All Status block, version 1 (see docs/protocol.md). Later versions
+// only append fields; the request names how many bytes the host can take.
+#define SMART_RELAY_STATUS_VERSION 1
+#define SMART_RELAY_STATUS_LEN 23
+
+#define SMART_RELAY_STATUS_RELAY_PERSIST   (1U << 0)
+#define SMART_RELAY_STATUS_RESET_ACTIVE_ON (1U << 1)
+#define SMART_RELAY_STATUS_WD_IN_RESET     (1U << 2)
+#define SMART_RELAY_STATUS_PC_OFF          (1U << 3)
+#define SMART_RELAY_STATUS_PC_SLEEP        (1U << 4)
+
+typedef struct {
+  uint8_t version;
+  uint8_t state_mask;
+  uint8_t init_mask;
+  uint8_t flags;  // SMART_RELAY_STATUS_* bits
+  uint8_t mode;   // SMART_RELAY_MODE_*
+  uint8_t mode_relay;
+  uint8_t shift_count;
+  uint32_t trip_count;
+  uint32_t eeprom_write_count;
+  uint16_t wd_remaining_sec;  // to the next trip, or to the end of the reset pulse
+  uint16_t pc_remaining_sec;  // to the forced sleep, or to power-on while off
+  uint8_t timer_mask;         // relays with a pending On/Off For revert
+  uint16_t next_timer_sec;    // soonest of those reverts
+} smart_relay_status_t;
+
+// Optional thread safety. The hooks follow mutex/condition-variable
+// semantics; wait() atomically unlocks, blocks until notify_all(), and
+// relocks. The mutex only guards bookkeeping and is never held across bus
+// I/O, so one ctx may be shared by many devices while each device keeps its
+// own smart_relay_sync_t and transactions on different devices overlap.
+// i2c_write/i2c_read must then tolerate concurrent calls for different
+// addresses (each call is one I2C message, e.g. Linux I2C_RDWR).
+#define SMART_RELAY_SYNC_FLIGHTS 4
+
+typedef struct {
+  uint8_t cmd;
+  uint8_t len;
+  uint8_t state;
+  uint8_t waiters;
+  int ret;
+  uint8_t data[SMART_RELAY_MAX_RESPONSE];
+} smart_relay_flight_t;
+
+typedef struct {
+  void *ctx;
+  void (*lock)(void *ctx);
+  void (*unlock)(void *ctx);
+  void (*wait)(void *ctx);
+  void (*notify_all)(void *ctx);
+  uint8_t busy;
+  uint32_t transactions;  // bus transactions performed
+  uint32_t coalesced;     // reads answered by another caller's transaction
+  smart_relay_flight_t flights[SMART_RELAY_SYNC_FLIGHTS];
+} smart_relay_sync_t;
 
 typedef struct {
   uint8_t address;
   int (*i2c_write)(uint8_t addr, const uint8_t *data, uint8_t len);
   int (*i2c_read)(uint8_t addr, uint8_t *data, uint8_t len);
+  void (*delay_ms)(uint16_t ms);  // optional, used for BUSY retries
+  uint8_t pec;                    // set by smart_relay_pec_enable(), do not touch
+  uint16_t pec_errors;            // CRC mismatches seen in either direction
+  smart_relay_sync_t *sync;       // optional, 0 = single-threaded use
 } smart_relay_t;
 
+// SMBus CRC-8 (polynomial 0x07), table driven
+uint8_t smart_relay_crc8(uint8_t crc, const uint8_t *data, uint8_t len);
+
 int smart_relay_relay_on(smart_relay_t *dev, uint8_t relay_id);
 int smart_relay_relay_off(smart_relay_t *dev, uint8_t relay_id);
 int smart_relay_relay_on_for(smart_relay_t *dev, uint8_t relay_id, uint16_t duration_sec);
 int smart_relay_relay_off_for(smart_relay_t *dev, uint8_t relay_id, uint16_t duration_sec);
+// Millisecond variants for short pulses, timed on the device. Older
+// firmware answers BAD_CMD.
+int smart_relay_relay_on_for_ms(smart_relay_t *dev, uint8_t relay_id, uint16_t duration_ms);
+int smart_relay_relay_off_for_ms(smart_relay_t *dev, uint8_t relay_id, uint16_t duration_ms);
+// Sends any command and returns its status byte in out_status instead of an
+// error code, for probing optional commands. Fails only on I/O or PEC errors.
+int smart_relay_command_status(smart_relay_t *dev, uint8_t cmd, const uint8_t *payload, uint8_t payload_len,
+                               uint8_t *out_status);
+// Sets every relay in relay_mask to its bit in state_mask in one transaction
+// (one EEPROM write with persistence on). Older firmware answers BAD_CMD.
+int smart_relay_relay_set_mask(smart_relay_t *dev, uint8_t relay_mask, uint8_t state_mask);
+// Split phase: write Relay Set Mask now, read its status later with
+// smart_relay_read_pending() (before the next command replaces it). Lets a
+// host switch many boards back-to-back. Not for handles with sync set.
+int smart_relay_relay_set_mask_send(smart_relay_t *dev, uint8_t relay_mask, uint8_t state_mask);
+int smart_relay_read_pending(smart_relay_t *dev);
 
 int smart_relay_watchdog_enable(smart_relay_t *dev, uint8_t relay_id);
 int smart_relay_watchdog_disable(smart_relay_t *dev);
@@ -95,4 +200,63 @@ int smart_relay_eeprom_get_version(smart_relay_t *dev, uint8_t *out_version);
 int smart_relay_device_info(smart_relay_t *dev, uint16_t *out_vendor_id, uint16_t *out_product_id,
                             uint8_t *out_revision, uint16_t *out_fw_version);
 
+// One round trip for relay state, persistence, trip count, EEPROM counters,
+// mode and remaining timers. Firmware without it answers BAD_CMD
+// (SMART_RELAY_ERR_STATUS); fall back to the individual reads.
+int smart_relay_get_all_status(smart_relay_t *dev, smart_relay_status_t *out_status);
+// Decodes a status block (the bytes after the status byte).
+int smart_relay_status_decode(const uint8_t *block, uint8_t len, smart_relay_status_t *out_status);
+
+// Packet error checking. Enable negotiates PEC with the device; firmware
+// without PEC support answers BAD_CMD and the handle stays in plain framing.
+int smart_relay_pec_enable(smart_relay_t *dev);
+int smart_relay_pec_disable(smart_relay_t *dev);
+// After a CRC failure on a PEC session: if the device answers a plain frame
+// it was reset and lost PEC, so PEC is enabled again. Returns
+// SMART_RELAY_ERR_PEC if it still speaks PEC (the failure was the bus), and
+// SMART_RELAY_ERR_PARAM if PEC was not enabled. The handle keeps PEC on
+// whatever the outcome, so a failed resync can be retried.
+int smart_relay_pec_resync(smart_relay_t *dev);
+
+// Broadcast groups. A device belongs to the groups set in its group_mask;
+// smart_relay_group_relay_set() switches relays on every member with one
+// general-call frame (sent through bus->i2c_write, bus->address is ignored).
+// Members leave status + seq pending, so group_confirm() needs one read per
+// member, falling back to Group Get when that response was replaced.
+int smart_relay_group_set(smart_relay_t *dev, uint8_t group_mask);
+int smart_relay_group_get(smart_relay_t *dev, uint8_t *out_group_mask, uint8_t *out_last_seq,
+                          uint8_t *out_last_status);
+int smart_relay_group_relay_set(const smart_relay_t *bus, uint8_t group_mask, uint8_t relay_mask, uint8_t state_mask,
+                                uint8_t seq);
+// Returns how many members did not confirm seq; out_results (optional) gets
+// a return code per member (SMART_RELAY_ERR_VERIFY = broadcast missed).
+uint8_t smart_relay_group_confirm(smart_relay_t *const *members, uint8_t count, uint8_t seq, int *out_results);
+
+// Watchdog heartbeat fast path. The ping frame (with PEC) is encoded once
+// and written without reading the status back; the status is read only on
+// every verify_every-th ping (0 = never) and after a NACK, where a full
+// ping is retried. A status left unread is replaced by the next command.
+typedef struct {
+  smart_relay_t *dev;
+  uint8_t frame[2];
+  uint8_t frame_address;
+  uint8_t verify_every;
+  uint8_t since_verify;
+  uint32_t sent;
+  uint32_t unverified;  // pings acknowledged at the I2C level only
+  uint32_t nacks;
+  uint32_t failures;    // pings known not to have reached the watchdog
+} smart_relay_heartbeat_t;
+
+void smart_relay_heartbeat_init(smart_relay_heartbeat_t *hb, smart_relay_t *dev, uint8_t verify_every);
+int smart_relay_heartbeat_ping(smart_relay_heartbeat_t *hb);
+// Pings every device back-to-back; returns how many failed (0 = all OK).
+uint8_t smart_relay_heartbeat_ping_all(smart_relay_heartbeat_t *hbs, uint8_t count);
+
+// Makes dev safe to share between threads: calls on the device are
+// serialized, and concurrent argument-free reads (relay state, trip count,
+// ...) queued behind the same in-flight transaction share one bus read.
+void smart_relay_sync_init(smart_relay_sync_t *sync, void *ctx, void (*lock)(void *ctx), void (*unlock)(void *ctx),
+                           void (*wait)(void *ctx), void (*notify_all)(void *ctx));
+
 #endif // SMART_RELAY_C_H
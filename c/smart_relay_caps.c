@@ -0,0 +1,247 @@
+#include "smart_relay_caps.h"
+
+#include <string.h>
+
+// A probe that got a clean answer tells whether the command exists: OK or
+// BUSY means supported, any other status (BAD_CMD) means not. Probes are
+// chosen to have no effect on the device.
+static int probe_result(int ret, uint8_t cap, uint8_t *caps) {
+  if (ret == SMART_RELAY_OK || ret == SMART_RELAY_ERR_BUSY) {
+    *caps |= cap;
+    return SMART_RELAY_OK;
+  }
+  return ret == SMART_RELAY_ERR_STATUS ? SMART_RELAY_OK : ret;
+}
+
+static int probe_all(smart_relay_t *dev, uint8_t *out_caps) {
+  uint8_t caps = 0;
+  int ret;
+
+  if (dev->pec) {
+    caps |= SMART_RELAY_CAP_PEC;
+  } else {
+    // PEC Set 0 on a plain session changes nothing.
+    ret = probe_result(smart_relay_pec_disable(dev), SMART_RELAY_CAP_PEC, &caps);
+    if (ret != SMART_RELAY_OK) return ret;
+  }
+
+  uint8_t group_mask, last_seq, last_status;
+  ret = probe_result(smart_relay_group_get(dev, &group_mask, &last_seq, &last_status), SMART_RELAY_CAP_GROUPS,
+                     &caps);
+  if (ret != SMART_RELAY_OK) return ret;
+
+  smart_relay_status_t status;
+  ret = probe_result(smart_relay_get_all_status(dev, &status), SMART_RELAY_CAP_ALL_STATUS, &caps);
+  if (ret != SMART_RELAY_OK) return ret;
+
+  // An empty relay_mask is a no-op.
+  ret = probe_result(smart_relay_relay_set_mask(dev, 0, 0), SMART_RELAY_CAP_RELAY_MASK, &caps);
+  if (ret != SMART_RELAY_OK) return ret;
+
+  // A zero duration is rejected with BAD_PARAM by firmware that knows the command.
+  uint8_t pulse[3] = { 0, 0, 0 };
+  uint8_t pulse_status = STATUS_OK;
+  ret = smart_relay_command_status(dev, CMD_RELAY_ON_FOR_MS, pulse, sizeof(pulse), &pulse_status);
+  if (ret != SMART_RELAY_OK) return ret;
+  if (pulse_status == STATUS_BUSY) {
+    return SMART_RELAY_ERR_BUSY;
+  }
+  if (pulse_status == STATUS_BAD_PARAM) {
+    caps |= SMART_RELAY_CAP_PULSE_MS;
+  }
+
+  *out_caps = caps;
+  return SMART_RELAY_OK;
+}
+
+static int relay_write(smart_relay_t *dev, uint8_t use_mask, uint8_t relay_mask, uint8_t state_mask) {
+  if (use_mask) {
+    return smart_relay_relay_set_mask(dev, relay_mask, state_mask);
+  }
+  // Fallback: called with a single relay bit.
+  uint8_t relay_id = 0;
+  while (!(relay_mask & (1U << relay_id))) {
+    relay_id++;
+  }
+  return (state_mask & relay_mask) ? smart_relay_relay_on(dev, relay_id) : smart_relay_relay_off(dev, relay_id);
+}
+
+static int write_with_retry(smart_relay_t *dev, uint8_t use_mask, uint8_t relay_mask, uint8_t state_mask) {
+  int ret = relay_write(dev, use_mask, relay_mask, state_mask);
+  for (uint8_t attempt = 0; ret == SMART_RELAY_ERR_BUSY && attempt < SMART_RELAY_CAPS_BUSY_RETRIES; attempt++) {
+    if (dev->delay_ms) {
+      dev->delay_ms((uint16_t)(SMART_RELAY_CAPS_BUSY_DELAY_MS << attempt));
+    }
+    ret = relay_write(dev, use_mask, relay_mask, state_mask);
+  }
+  return ret;
+}
+
+static smart_relay_caps_entry_t *cache_find(smart_relay_caps_cache_t *cache, const smart_relay_caps_t *caps) {
+  for (uint8_t i = 0; i < SMART_RELAY_CAPS_CACHE_SIZE; i++) {
+    smart_relay_caps_entry_t *e = &cache->entries[i];
+    if (e->valid && e->vendor_id == caps->vendor_id && e->product_id == caps->product_id &&
+        e->fw_version == caps->fw_version) {
+      return e;
+    }
+  }
+  return 0;
+}
+
+static void cache_store(smart_relay_caps_cache_t *cache, const smart_relay_caps_t *caps) {
+  smart_relay_caps_entry_t *e = &cache->entries[cache->next];
+  cache->next = (uint8_t)((cache->next + 1) % SMART_RELAY_CAPS_CACHE_SIZE);
+  e->vendor_id = caps->vendor_id;
+  e->product_id = caps->product_id;
+  e->fw_version = caps->fw_version;
+  e->caps = caps->caps;
+  e->valid = 1;
+}
+
+void smart_relay_caps_cache_init(smart_relay_caps_cache_t *cache) {
+  if (cache != 0) {
+    memset(cache, 0, sizeof(*cache));
+  }
+}
+
+void smart_relay_caps_init(smart_relay_caps_t *caps, smart_relay_t *dev, smart_relay_caps_cache_t *cache) {
+  if (caps == 0) {
+    return;
+  }
+  memset(caps, 0, sizeof(*caps));
+  caps->dev = dev;
+  caps->cache = cache;
+}
+
+void smart_relay_caps_invalidate(smart_relay_caps_t *caps) {
+  if (caps != 0) {
+    caps->known = 0;
+  }
+}
+
+// Device Info, then the cache or the probes.
+static int resolve(smart_relay_caps_t *caps) {
+  uint8_t revision = 0;
+  int ret = smart_relay_device_info(caps->dev, &caps->vendor_id, &caps->product_id, &revision, &caps->fw_version);
+  if (ret == SMART_RELAY_ERR_STATUS) {
+    // Firmware older than Device Info: key on the version alone.
+    caps->vendor_id = 0;
+    caps->product_id = 0;
+    ret = smart_relay_firmware_get_version(caps->dev, &caps->fw_version);
+  }
+  if (ret != SMART_RELAY_OK) return ret;
+
+  smart_relay_caps_entry_t *e = caps->cache != 0 ? cache_find(caps->cache, caps) : 0;
+  if (e != 0) {
+    caps->cache->hits++;
+    caps->caps = e->caps;
+    return SMART_RELAY_OK;
+  }
+  ret = probe_all(caps->dev, &caps->caps);
+  if (ret != SMART_RELAY_OK) return ret;
+  if (caps->cache != 0) {
+    caps->cache->misses++;
+    cache_store(caps->cache, caps);
+  }
+  return SMART_RELAY_OK;
+}
+
+int smart_relay_caps_query(smart_relay_caps_t *caps, uint8_t *out_caps) {
+  if (caps == 0 || caps->dev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  if (!caps->known) {
+    caps->error = resolve(caps);
+    if (caps->error != SMART_RELAY_OK) return caps->error;
+    caps->known = 1;
+  }
+  if (out_caps != 0) {
+    *out_caps = caps->caps;
+  }
+  return SMART_RELAY_OK;
+}
+
+int smart_relay_caps_relay_set_mask(smart_relay_caps_t *caps, uint8_t relay_mask, uint8_t state_mask) {
+  return smart_relay_caps_relay_set_mask_ex(caps, relay_mask, state_mask, 0);
+}
+
+int smart_relay_caps_relay_set_mask_ex(smart_relay_caps_t *caps, uint8_t relay_mask, uint8_t state_mask,
+                                       uint8_t *out_done_mask) {
+  uint8_t done = 0;
+  if (out_done_mask != 0) {
+    *out_done_mask = 0;
+  }
+  int ret = smart_relay_caps_query(caps, 0);
+  if (ret != SMART_RELAY_OK) return ret;
+  if (caps->caps & SMART_RELAY_CAP_RELAY_MASK) {
+    ret = write_with_retry(caps->dev, 1, relay_mask, state_mask);
+    done = ret == SMART_RELAY_OK ? relay_mask : 0;
+  } else {
+    for (uint8_t i = 0; i < 8 && ret == SMART_RELAY_OK; i++) {
+      uint8_t bit = (uint8_t)(1U << i);
+      if (!(relay_mask & bit)) {
+        continue;
+      }
+      ret = write_with_retry(caps->dev, 0, bit, state_mask);
+      if (ret == SMART_RELAY_OK) {
+        done |= bit;
+      }
+    }
+  }
+  if (out_done_mask != 0) {
+    *out_done_mask = done;
+  }
+  return ret;
+}
+
+int smart_relay_caps_relay_pulse_ms(smart_relay_caps_t *caps, uint8_t relay_id, uint8_t on, uint16_t duration_ms) {
+  int ret = smart_relay_caps_query(caps, 0);
+  if (ret != SMART_RELAY_OK) return ret;
+  smart_relay_t *dev = caps->dev;
+  if (caps->caps & SMART_RELAY_CAP_PULSE_MS) {
+    return on ? smart_relay_relay_on_for_ms(dev, relay_id, duration_ms)
+              : smart_relay_relay_off_for_ms(dev, relay_id, duration_ms);
+  }
+  if (duration_ms % 1000 == 0) {
+    uint16_t sec = (uint16_t)(duration_ms / 1000);
+    return on ? smart_relay_relay_on_for(dev, relay_id, sec) : smart_relay_relay_off_for(dev, relay_id, sec);
+  }
+  if (dev->delay_ms == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  ret = on ? smart_relay_relay_on(dev, relay_id) : smart_relay_relay_off(dev, relay_id);
+  if (ret != SMART_RELAY_OK) return ret;
+  dev->delay_ms(duration_ms);
+  return on ? smart_relay_relay_off(dev, relay_id) : smart_relay_relay_on(dev, relay_id);
+}
+
+int smart_relay_caps_get_status(smart_relay_caps_t *caps, smart_relay_status_t *out_status) {
+  if (out_status == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  int ret = smart_relay_caps_query(caps, 0);
+  if (ret != SMART_RELAY_OK) return ret;
+  if (caps->caps & SMART_RELAY_CAP_ALL_STATUS) {
+    return smart_relay_get_all_status(caps->dev, out_status);
+  }
+
+  smart_relay_t *dev = caps->dev;
+  uint8_t persist = 0;
+  uint8_t active_state = 0;
+  memset(out_status, 0, sizeof(*out_status));
+  ret = smart_relay_relay_get_state(dev, &out_status->state_mask, &out_status->init_mask);
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = smart_relay_relay_state_persist_get(dev, &persist);
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = smart_relay_watchdog_get_reset_active_state(dev, &active_state);
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = smart_relay_watchdog_get_trip_count(dev, &out_status->trip_count);
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = smart_relay_eeprom_get_write_count(dev, &out_status->eeprom_write_count);
+  if (ret != SMART_RELAY_OK) return ret;
+  ret = smart_relay_eeprom_get_shift_count(dev, &out_status->shift_count);
+  if (ret != SMART_RELAY_OK) return ret;
+  out_status->flags = (uint8_t)((persist ? SMART_RELAY_STATUS_RELAY_PERSIST : 0) |
+                                (active_state ? SMART_RELAY_STATUS_RESET_ACTIVE_ON : 0));
+  return SMART_RELAY_OK;
+}
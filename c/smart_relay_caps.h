@@ -0,0 +1,75 @@
+#ifndef SMART_RELAY_CAPS_C_H
+#define SMART_RELAY_CAPS_C_H
+
+#include <stdint.h>
+#include "smart_relay.h"
+
+// Capability negotiation. Each device is asked for its Device Info once;
+// the optional commands it supports are then looked up in a cache keyed by
+// vendor/product/firmware, and only probed on a miss. Routed operations use
+// the fastest command the device has and fall back to the basic ones.
+// A cache may be shared by many devices but is not thread-safe.
+
+#define SMART_RELAY_CAP_PEC        (1U << 0)
+#define SMART_RELAY_CAP_GROUPS     (1U << 1)
+#define SMART_RELAY_CAP_ALL_STATUS (1U << 2)
+#define SMART_RELAY_CAP_RELAY_MASK (1U << 3)
+#define SMART_RELAY_CAP_PULSE_MS   (1U << 4)
+
+#define SMART_RELAY_CAPS_CACHE_SIZE 8
+
+// Routed writes retry BUSY (EEPROM write in progress) with doubling delays
+#define SMART_RELAY_CAPS_BUSY_RETRIES 3
+#define SMART_RELAY_CAPS_BUSY_DELAY_MS 5
+
+typedef struct {
+  uint16_t vendor_id;
+  uint16_t product_id;
+  uint16_t fw_version;
+  uint8_t caps;
+  uint8_t valid;
+} smart_relay_caps_entry_t;
+
+typedef struct {
+  smart_relay_caps_entry_t entries[SMART_RELAY_CAPS_CACHE_SIZE];
+  uint8_t next;     // replacement slot once full
+  uint32_t hits;
+  uint32_t misses;  // each miss costs one probe per optional command
+} smart_relay_caps_cache_t;
+
+typedef struct {
+  smart_relay_t *dev;
+  smart_relay_caps_cache_t *cache;  // may be 0: probe every device
+  uint8_t known;
+  uint8_t caps;  // SMART_RELAY_CAP_* bits, valid once known
+  int error;     // why the last query failed, SMART_RELAY_OK otherwise
+  uint16_t vendor_id;
+  uint16_t product_id;
+  uint16_t fw_version;
+} smart_relay_caps_t;
+
+void smart_relay_caps_cache_init(smart_relay_caps_cache_t *cache);
+void smart_relay_caps_init(smart_relay_caps_t *caps, smart_relay_t *dev, smart_relay_caps_cache_t *cache);
+
+// Queries the device on first use; later calls return the stored bitmap.
+int smart_relay_caps_query(smart_relay_caps_t *caps, uint8_t *out_caps);
+// Forgets the device's capabilities, e.g. after a firmware update.
+void smart_relay_caps_invalidate(smart_relay_caps_t *caps);
+
+// Relay Set Mask where supported, otherwise one Relay On/Off per relay.
+int smart_relay_caps_relay_set_mask(smart_relay_caps_t *caps, uint8_t relay_mask, uint8_t state_mask);
+// Same, and sets out_done_mask to the relays the device acknowledged. The
+// per-relay fallback stops at the first failure, after switching the
+// relays before it.
+int smart_relay_caps_relay_set_mask_ex(smart_relay_caps_t *caps, uint8_t relay_mask, uint8_t state_mask,
+                                       uint8_t *out_done_mask);
+// Relay On/Off For Ms where supported. Otherwise whole seconds use Relay
+// On/Off For, and anything else is switched, timed with dev->delay_ms and
+// switched back (two transactions, width subject to host latency).
+int smart_relay_caps_relay_pulse_ms(smart_relay_caps_t *caps, uint8_t relay_id, uint8_t on, uint16_t duration_ms);
+// Get All Status where supported, otherwise the individual reads. The
+// fallback fills relay state, persistence, reset polarity, trip count and
+// EEPROM counters and reports version 0; mode and timers stay zero.
+int smart_relay_caps_get_status(smart_relay_caps_t *caps, smart_relay_status_t *out_status);
+
+#endif // SMART_RELAY_CAPS_C_H
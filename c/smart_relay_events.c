@@ -0,0 +1,361 @@
+#include "smart_relay_events.h"
+
+#include <string.h>
+
+static int32_t time_diff(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b);
+}
+
+static uint8_t near_deadline(const smart_relay_events_t *ev, uint32_t deadline_ms, uint32_t now_ms) {
+  int32_t dt = time_diff(deadline_ms, now_ms);
+  return (dt <= (int32_t)ev->guard_ms && dt >= -(int32_t)ev->guard_ms) ? 1 : 0;
+}
+
+static void emit(smart_relay_events_t *ev, uint8_t type, uint8_t relay_id, uint8_t state, uint8_t expected,
+                 uint32_t now_ms) {
+  ev->events++;
+  if (ev->cb[type] == 0) {
+    return;
+  }
+  smart_relay_event_t event;
+  event.type = type;
+  event.relay_id = relay_id;
+  event.state = state;
+  event.expected = expected;
+  event.trip_count = ev->trip_count;
+  event.time_ms = now_ms;
+  ev->cb[type](ev->dev, &event, ev->cb_user[type]);
+}
+
+static void note_commanded(smart_relay_events_t *ev, uint8_t relay_id, uint8_t on) {
+  // Host-initiated changes are not reported back as events.
+  if (!ev->primed || relay_id >= SMART_RELAY_EVENTS_MAX_RELAYS) {
+    return;
+  }
+  uint8_t bit = (uint8_t)(1U << relay_id);
+  ev->init_mask |= bit;
+  if (on) {
+    ev->state_mask |= bit;
+  } else {
+    ev->state_mask &= (uint8_t)~bit;
+  }
+}
+
+static void schedule(smart_relay_events_t *ev, uint32_t now_ms) {
+  uint32_t next = now_ms + ev->idle_ms;
+  uint32_t deadlines[SMART_RELAY_EVENTS_MAX_RELAYS + 2];
+  uint8_t count = 0;
+
+  for (uint8_t i = 0; i < SMART_RELAY_EVENTS_MAX_RELAYS; i++) {
+    if (ev->timer_mask & (1U << i)) {
+      deadlines[count++] = ev->timer_deadline_ms[i];
+    }
+  }
+  if (ev->wd_armed) {
+    deadlines[count++] = ev->wd_deadline_ms;
+  }
+  if (ev->pc_armed && ev->pc_pending) {
+    deadlines[count++] = ev->pc_deadline_ms;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    int32_t dt = time_diff(deadlines[i], now_ms);
+    uint32_t candidate;
+    if (dt < -(int32_t)ev->guard_ms) {
+      continue;
+    }
+    if (dt <= (int32_t)ev->guard_ms) {
+      candidate = now_ms + ev->fast_ms;
+    } else {
+      candidate = deadlines[i] - ev->guard_ms;
+    }
+    if (time_diff(candidate, next) < 0) {
+      next = candidate;
+    }
+  }
+  ev->next_poll_ms = next;
+}
+
+void smart_relay_events_init(smart_relay_events_t *ev, smart_relay_t *dev) {
+  if (ev == 0) {
+    return;
+  }
+  memset(ev, 0, sizeof(*ev));
+  ev->dev = dev;
+  ev->idle_ms = SMART_RELAY_EVENTS_IDLE_MS;
+  ev->fast_ms = SMART_RELAY_EVENTS_FAST_MS;
+  ev->guard_ms = SMART_RELAY_EVENTS_GUARD_MS;
+  ev->wd_backoff = 1;
+}
+
+int smart_relay_events_on(smart_relay_events_t *ev, uint8_t type, smart_relay_event_cb_t cb, void *user) {
+  if (ev == 0 || type >= SMART_RELAY_EVENT_TYPE_COUNT) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  ev->cb[type] = cb;
+  ev->cb_user[type] = user;
+  return SMART_RELAY_OK;
+}
+
+void smart_relay_events_set_intervals(smart_relay_events_t *ev, uint16_t idle_ms, uint16_t fast_ms, uint16_t guard_ms) {
+  if (ev == 0 || fast_ms == 0 || idle_ms < fast_ms) {
+    return;
+  }
+  ev->idle_ms = idle_ms;
+  ev->fast_ms = fast_ms;
+  ev->guard_ms = guard_ms;
+}
+
+void smart_relay_events_expect_timer(smart_relay_events_t *ev, uint8_t relay_id, uint8_t revert_state,
+                                     uint32_t duration_ms, uint32_t now_ms) {
+  if (ev == 0 || relay_id >= SMART_RELAY_EVENTS_MAX_RELAYS) {
+    return;
+  }
+  uint8_t bit = (uint8_t)(1U << relay_id);
+  ev->timer_mask |= bit;
+  if (revert_state) {
+    ev->timer_revert_mask |= bit;
+  } else {
+    ev->timer_revert_mask &= (uint8_t)~bit;
+  }
+  ev->timer_deadline_ms[relay_id] = now_ms + duration_ms;
+  schedule(ev, now_ms);
+}
+
+int smart_relay_events_relay_on_for(smart_relay_events_t *ev, uint8_t relay_id, uint16_t duration_sec, uint32_t now_ms) {
+  if (ev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  int ret = smart_relay_relay_on_for(ev->dev, relay_id, duration_sec);
+  if (ret != SMART_RELAY_OK) return ret;
+  note_commanded(ev, relay_id, 1);
+  smart_relay_events_expect_timer(ev, relay_id, 0, (uint32_t)duration_sec * 1000UL, now_ms);
+  return SMART_RELAY_OK;
+}
+
+int smart_relay_events_relay_off_for(smart_relay_events_t *ev, uint8_t relay_id, uint16_t duration_sec, uint32_t now_ms) {
+  if (ev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  int ret = smart_relay_relay_off_for(ev->dev, relay_id, duration_sec);
+  if (ret != SMART_RELAY_OK) return ret;
+  note_commanded(ev, relay_id, 0);
+  smart_relay_events_expect_timer(ev, relay_id, 1, (uint32_t)duration_sec * 1000UL, now_ms);
+  return SMART_RELAY_OK;
+}
+
+void smart_relay_events_watch_watchdog(smart_relay_events_t *ev, uint8_t relay_id, uint16_t timeout_sec,
+                                       uint16_t reset_sec, uint8_t active_state, uint32_t now_ms) {
+  if (ev == 0 || relay_id >= SMART_RELAY_EVENTS_MAX_RELAYS) {
+    return;
+  }
+  ev->wd_armed = 1;
+  ev->pc_armed = 0;  // modes are exclusive on the device
+  ev->wd_relay = relay_id;
+  ev->wd_active_state = active_state ? 1 : 0;
+  ev->wd_timeout_ms = (uint32_t)timeout_sec * 1000UL;
+  ev->wd_reset_ms = (uint32_t)reset_sec * 1000UL;
+  ev->trip_known = 0;
+  smart_relay_events_note_ping(ev, now_ms);
+}
+
+void smart_relay_events_note_ping(smart_relay_events_t *ev, uint32_t now_ms) {
+  if (ev == 0 || !ev->wd_armed) {
+    return;
+  }
+  ev->wd_backoff = 1;
+  ev->wd_deadline_ms = now_ms + ev->wd_timeout_ms;
+  schedule(ev, now_ms);
+}
+
+int smart_relay_events_watchdog_ping(smart_relay_events_t *ev, uint32_t now_ms) {
+  if (ev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  int ret = smart_relay_watchdog_ping(ev->dev);
+  if (ret != SMART_RELAY_OK) return ret;
+  smart_relay_events_note_ping(ev, now_ms);
+  return SMART_RELAY_OK;
+}
+
+void smart_relay_events_watch_power_cycle(smart_relay_events_t *ev, uint8_t relay_id, uint16_t max_on_sec, uint32_t now_ms) {
+  if (ev == 0 || relay_id >= SMART_RELAY_EVENTS_MAX_RELAYS) {
+    return;
+  }
+  ev->pc_armed = 1;
+  ev->wd_armed = 0;
+  ev->pc_relay = relay_id;
+  ev->pc_max_on_ms = (uint32_t)max_on_sec * 1000UL;
+  ev->pc_pending = max_on_sec > 0 ? 1 : 0;
+  ev->pc_deadline_ms = now_ms + ev->pc_max_on_ms;
+  ev->pc_sleep_requested = 0;
+  schedule(ev, now_ms);
+}
+
+void smart_relay_events_note_sleep(smart_relay_events_t *ev, uint16_t off_sec, uint32_t now_ms) {
+  if (ev == 0 || !ev->pc_armed) {
+    return;
+  }
+  ev->pc_off_ms = (uint32_t)off_sec * 1000UL;
+  ev->pc_sleep_requested = 1;
+  ev->pc_pending = 1;
+  ev->pc_deadline_ms = now_ms + ev->pc_off_ms;
+  // Catch the immediate OFF transition quickly.
+  ev->next_poll_ms = now_ms + ev->fast_ms;
+}
+
+int smart_relay_events_power_cycle_sleep(smart_relay_events_t *ev, uint16_t off_sec, uint32_t now_ms) {
+  if (ev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  int ret = smart_relay_power_cycle_sleep(ev->dev, off_sec);
+  if (ret != SMART_RELAY_OK) return ret;
+  smart_relay_events_note_sleep(ev, off_sec, now_ms);
+  return SMART_RELAY_OK;
+}
+
+void smart_relay_events_unwatch(smart_relay_events_t *ev) {
+  if (ev == 0) {
+    return;
+  }
+  ev->wd_armed = 0;
+  ev->pc_armed = 0;
+  ev->pc_pending = 0;
+  ev->timer_mask = 0;
+}
+
+static int check_trips(smart_relay_events_t *ev, uint32_t now_ms) {
+  uint32_t count = 0;
+  int ret = smart_relay_watchdog_get_trip_count(ev->dev, &count);
+  ev->bus_reads++;
+  if (ret != SMART_RELAY_OK) return ret;
+
+  if (!ev->trip_known) {
+    ev->trip_known = 1;
+    ev->trip_count = count;
+    return SMART_RELAY_OK;
+  }
+
+  if (count != ev->trip_count && !ev->wd_armed) {
+    // No watchdog model to check the trip against.
+    ev->trip_count = count;
+    emit(ev, SMART_RELAY_EVENT_WATCHDOG_TRIP, ev->wd_relay, ev->wd_active_state, 0, now_ms);
+  } else if (count != ev->trip_count) {
+    uint8_t expected = time_diff(now_ms, ev->wd_deadline_ms) >= -(int32_t)ev->guard_ms ? 1 : 0;
+    ev->trip_count = count;
+    if (ev->wd_backoff < SMART_RELAY_EVENTS_WD_MAX_BACKOFF) {
+      ev->wd_backoff = (uint8_t)(ev->wd_backoff * 2);
+    }
+    // The ping timeout restarts once the reset pulse has finished.
+    ev->wd_deadline_ms = now_ms + ev->wd_reset_ms + ev->wd_timeout_ms * ev->wd_backoff;
+    uint8_t on = (uint8_t)((ev->state_mask >> ev->wd_relay) & 1U);
+    if (on == ev->wd_active_state) {
+      smart_relay_events_expect_timer(ev, ev->wd_relay, on ? 0 : 1, ev->wd_reset_ms, now_ms);
+    }
+    emit(ev, SMART_RELAY_EVENT_WATCHDOG_TRIP, ev->wd_relay, ev->wd_active_state, expected, now_ms);
+  } else if (time_diff(now_ms, ev->wd_deadline_ms) > (int32_t)ev->guard_ms) {
+    // No trip past the deadline: someone else is pinging. Restart the estimate.
+    ev->wd_backoff = 1;
+    ev->wd_deadline_ms = now_ms + ev->wd_timeout_ms;
+  }
+  return SMART_RELAY_OK;
+}
+
+int smart_relay_events_poll(smart_relay_events_t *ev, uint32_t now_ms, uint32_t *out_next_ms) {
+  if (ev == 0 || ev->dev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  if (ev->primed && time_diff(now_ms, ev->next_poll_ms) < 0) {
+    if (out_next_ms) *out_next_ms = ev->next_poll_ms - now_ms;
+    return SMART_RELAY_OK;
+  }
+
+  uint8_t state_mask = 0;
+  uint8_t init_mask = 0;
+  int ret = smart_relay_relay_get_state(ev->dev, &state_mask, &init_mask);
+  ev->bus_reads++;
+  if (ret != SMART_RELAY_OK) {
+    ev->next_poll_ms = now_ms + ev->fast_ms;
+    if (out_next_ms) *out_next_ms = ev->fast_ms;
+    return ret;
+  }
+
+  uint8_t need_trips = (ev->wd_armed && !ev->trip_known) ? 1 : 0;
+
+  if (ev->primed) {
+    uint8_t changed = (uint8_t)((state_mask ^ ev->state_mask) & init_mask & ev->init_mask);
+    for (uint8_t i = 0; i < SMART_RELAY_EVENTS_MAX_RELAYS; i++) {
+      uint8_t bit = (uint8_t)(1U << i);
+      if (!(changed & bit)) {
+        continue;
+      }
+      uint8_t on = (state_mask & bit) ? 1 : 0;
+      uint8_t expected = 0;
+
+      if (ev->timer_mask & bit) {
+        uint8_t revert = (ev->timer_revert_mask & bit) ? 1 : 0;
+        expected = (on == revert && near_deadline(ev, ev->timer_deadline_ms[i], now_ms)) ? 1 : 0;
+        ev->timer_mask &= (uint8_t)~bit;
+      }
+
+      if (ev->wd_armed && i == ev->wd_relay) {
+        need_trips = 1;
+        if (on == ev->wd_active_state && time_diff(now_ms, ev->wd_deadline_ms) >= -(int32_t)ev->guard_ms) {
+          expected = 1;
+        }
+      }
+
+      if (ev->pc_armed && i == ev->pc_relay) {
+        uint8_t requested = (!on && ev->pc_sleep_requested) ? 1 : 0;
+        uint8_t pc_expected = requested;
+        if (ev->pc_pending && near_deadline(ev, ev->pc_deadline_ms, now_ms)) {
+          pc_expected = 1;
+        }
+        if (on) {
+          ev->pc_pending = ev->pc_max_on_ms > 0 ? 1 : 0;
+          ev->pc_deadline_ms = now_ms + ev->pc_max_on_ms;
+        } else if (requested) {
+          // Wake-up deadline was recorded by note_sleep().
+          ev->pc_sleep_requested = 0;
+        } else {
+          // Fallback sleep reuses the last configured off duration.
+          ev->pc_pending = ev->pc_off_ms > 0 ? 1 : 0;
+          ev->pc_deadline_ms = now_ms + ev->pc_off_ms;
+        }
+        emit(ev, SMART_RELAY_EVENT_POWER_CYCLE, i, on, pc_expected, now_ms);
+        expected = pc_expected;
+      }
+
+      emit(ev, SMART_RELAY_EVENT_RELAY_CHANGED, i, on, expected, now_ms);
+    }
+
+    // Drop timer expectations that were cancelled or missed.
+    for (uint8_t i = 0; i < SMART_RELAY_EVENTS_MAX_RELAYS; i++) {
+      if ((ev->timer_mask & (1U << i)) &&
+          time_diff(now_ms, ev->timer_deadline_ms[i]) > (int32_t)ev->guard_ms) {
+        ev->timer_mask &= (uint8_t)~(1U << i);
+      }
+    }
+    if (ev->pc_armed && ev->pc_pending && time_diff(now_ms, ev->pc_deadline_ms) > (int32_t)ev->guard_ms) {
+      ev->pc_pending = 0;
+    }
+  }
+
+  ev->state_mask = state_mask;
+  ev->init_mask = init_mask;
+  ev->primed = 1;
+
+  if (ev->wd_armed && time_diff(now_ms, ev->wd_deadline_ms) > (int32_t)ev->guard_ms) {
+    need_trips = 1;
+  }
+  if (!ev->wd_armed && ev->cb[SMART_RELAY_EVENT_WATCHDOG_TRIP] != 0) {
+    need_trips = 1;
+  }
+  if (need_trips) {
+    ret = check_trips(ev, now_ms);
+  }
+
+  schedule(ev, now_ms);
+  if (out_next_ms) *out_next_ms = ev->next_poll_ms - now_ms;
+  return ret;
+}
@@ -0,0 +1,110 @@
+#ifndef SMART_RELAY_EVENTS_C_H
+#define SMART_RELAY_EVENTS_C_H
+
+#include <stdint.h>
+#include "smart_relay.h"
+
+// Change notifications built on top of Relay Get State / Watchdog Get Trip Count.
+// The host calls smart_relay_events_poll() from its main loop with a millisecond
+// clock; the bus is only touched when the adaptive poll interval has elapsed.
+
+#define SMART_RELAY_EVENTS_MAX_RELAYS 8
+
+// Host-side cap for the watchdog timeout doubling after repeated trips
+#define SMART_RELAY_EVENTS_WD_MAX_BACKOFF 64
+
+// Default poll intervals (ms)
+#define SMART_RELAY_EVENTS_IDLE_MS 2000
+#define SMART_RELAY_EVENTS_FAST_MS 100
+#define SMART_RELAY_EVENTS_GUARD_MS 500
+
+// Event types
+enum {
+  SMART_RELAY_EVENT_RELAY_CHANGED = 0,
+  SMART_RELAY_EVENT_WATCHDOG_TRIP = 1,
+  SMART_RELAY_EVENT_POWER_CYCLE = 2,
+  SMART_RELAY_EVENT_TYPE_COUNT = 3
+};
+
+typedef struct {
+  uint8_t type;
+  uint8_t relay_id;
+  uint8_t state;        // RELAY_CHANGED: 1=ON; POWER_CYCLE: 1=powered, 0=off
+  uint8_t expected;     // 1 if the change matched a known deadline
+  uint32_t trip_count;  // WATCHDOG_TRIP: new trip counter value
+  uint32_t time_ms;     // host time the change was observed
+} smart_relay_event_t;
+
+typedef void (*smart_relay_event_cb_t)(smart_relay_t *dev, const smart_relay_event_t *event, void *user);
+
+typedef struct {
+  smart_relay_t *dev;
+  smart_relay_event_cb_t cb[SMART_RELAY_EVENT_TYPE_COUNT];
+  void *cb_user[SMART_RELAY_EVENT_TYPE_COUNT];
+
+  uint16_t idle_ms;
+  uint16_t fast_ms;
+  uint16_t guard_ms;
+
+  uint8_t primed;
+  uint8_t state_mask;
+  uint8_t init_mask;
+  uint32_t trip_count;
+  uint32_t next_poll_ms;
+
+  // Pending Relay On/Off For timers
+  uint8_t timer_mask;
+  uint8_t timer_revert_mask;
+  uint32_t timer_deadline_ms[SMART_RELAY_EVENTS_MAX_RELAYS];
+
+  // Watchdog model (mirrors firmware backoff)
+  uint8_t wd_armed;
+  uint8_t wd_relay;
+  uint8_t wd_active_state;
+  uint8_t wd_backoff;
+  uint8_t trip_known;
+  uint32_t wd_timeout_ms;
+  uint32_t wd_reset_ms;
+  uint32_t wd_deadline_ms;
+
+  // Power cycle model
+  uint8_t pc_armed;
+  uint8_t pc_relay;
+  uint8_t pc_pending;
+  uint8_t pc_sleep_requested;
+  uint32_t pc_max_on_ms;
+  uint32_t pc_off_ms;
+  uint32_t pc_deadline_ms;
+
+  // Statistics
+  uint32_t bus_reads;
+  uint32_t events;
+} smart_relay_events_t;
+
+void smart_relay_events_init(smart_relay_events_t *ev, smart_relay_t *dev);
+// A WATCHDOG_TRIP callback also works without watch_watchdog(): the trip
+// counter is then read on every poll and trips are reported as unexpected.
+int smart_relay_events_on(smart_relay_events_t *ev, uint8_t type, smart_relay_event_cb_t cb, void *user);
+void smart_relay_events_set_intervals(smart_relay_events_t *ev, uint16_t idle_ms, uint16_t fast_ms, uint16_t guard_ms);
+
+// Deadline hints. The *_for and ping/sleep wrappers issue the command and record the hint.
+void smart_relay_events_expect_timer(smart_relay_events_t *ev, uint8_t relay_id, uint8_t revert_state,
+                                     uint32_t duration_ms, uint32_t now_ms);
+int smart_relay_events_relay_on_for(smart_relay_events_t *ev, uint8_t relay_id, uint16_t duration_sec, uint32_t now_ms);
+int smart_relay_events_relay_off_for(smart_relay_events_t *ev, uint8_t relay_id, uint16_t duration_sec, uint32_t now_ms);
+
+void smart_relay_events_watch_watchdog(smart_relay_events_t *ev, uint8_t relay_id, uint16_t timeout_sec,
+                                       uint16_t reset_sec, uint8_t active_state, uint32_t now_ms);
+void smart_relay_events_note_ping(smart_relay_events_t *ev, uint32_t now_ms);
+int smart_relay_events_watchdog_ping(smart_relay_events_t *ev, uint32_t now_ms);
+
+void smart_relay_events_watch_power_cycle(smart_relay_events_t *ev, uint8_t relay_id, uint16_t max_on_sec, uint32_t now_ms);
+void smart_relay_events_note_sleep(smart_relay_events_t *ev, uint16_t off_sec, uint32_t now_ms);
+int smart_relay_events_power_cycle_sleep(smart_relay_events_t *ev, uint16_t off_sec, uint32_t now_ms);
+
+void smart_relay_events_unwatch(smart_relay_events_t *ev);
+
+// Polls the device if due. *out_next_ms (optional) receives the delay until the next poll.
+int smart_relay_events_poll(smart_relay_events_t *ev, uint32_t now_ms, uint32_t *out_next_ms);
+
+#endif // SMART_RELAY_EVENTS_C_H
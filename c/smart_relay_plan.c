@@ -0,0 +1,166 @@
+#include "smart_relay_plan.h"
+
+#include <string.h>
+
+static smart_relay_plan_op_t *find_op(smart_relay_plan_t *plan, const smart_relay_board_t *board) {
+  for (uint8_t i = 0; i < plan->count; i++) {
+    if (plan->ops[i].board == board) {
+      return &plan->ops[i];
+    }
+  }
+  return 0;
+}
+
+void smart_relay_plan_init(smart_relay_plan_t *plan) {
+  if (plan != 0) {
+    memset(plan, 0, sizeof(*plan));
+  }
+}
+
+int smart_relay_plan_add(smart_relay_plan_t *plan, const smart_relay_load_t *load, uint8_t on) {
+  if (plan == 0 || load == 0 || (load->count > 0 && load->members == 0)) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  // Validate everything first, so a failed add leaves the plan untouched.
+  uint8_t new_boards = 0;
+  for (uint8_t i = 0; i < load->count; i++) {
+    const smart_relay_member_t *m = &load->members[i];
+    if (m->board == 0 || m->relay_id > 7) {
+      return SMART_RELAY_ERR_PARAM;
+    }
+    if (find_op(plan, m->board) != 0) {
+      continue;
+    }
+    uint8_t seen = 0;
+    for (uint8_t j = 0; j < i && !seen; j++) {
+      seen = load->members[j].board == m->board;
+    }
+    if (!seen) {
+      new_boards++;
+    }
+  }
+  if (new_boards > SMART_RELAY_PLAN_MAX_OPS - plan->count) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+
+  for (uint8_t i = 0; i < load->count; i++) {
+    const smart_relay_member_t *m = &load->members[i];
+    smart_relay_plan_op_t *op = find_op(plan, m->board);
+    if (op == 0) {
+      op = &plan->ops[plan->count++];
+      op->board = m->board;
+      op->relay_mask = 0;
+      op->state_mask = 0;
+      op->done_mask = 0;
+      op->ret = SMART_RELAY_OK;
+    }
+    uint8_t bit = (uint8_t)(1U << m->relay_id);
+    op->relay_mask |= bit;
+    if (on) {
+      op->state_mask |= bit;
+    } else {
+      op->state_mask &= (uint8_t)~bit;
+    }
+  }
+  return SMART_RELAY_OK;
+}
+
+uint8_t smart_relay_plan_execute_bus(smart_relay_plan_t *plan, uint8_t bus) {
+  if (plan == 0) {
+    return 0;
+  }
+  // This bus's ops in address order.
+  smart_relay_plan_op_t *ops[SMART_RELAY_PLAN_MAX_OPS];
+  uint8_t sent[SMART_RELAY_PLAN_MAX_OPS];
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < plan->count; i++) {
+    smart_relay_plan_op_t *op = &plan->ops[i];
+    if (op->board->bus != bus) {
+      continue;
+    }
+    uint8_t j = n++;
+    while (j > 0 && ops[j - 1]->board->caps.dev->address > op->board->caps.dev->address) {
+      ops[j] = ops[j - 1];
+      j--;
+    }
+    ops[j] = op;
+  }
+
+  // Capabilities must be known already: resolving them here would write the
+  // shared cache from several bus threads. A board whose query failed keeps
+  // that error, so an offline board is not reported as a bad request.
+  for (uint8_t k = 0; k < n; k++) {
+    const smart_relay_caps_t *caps = &ops[k]->board->caps;
+    ops[k]->done_mask = 0;
+    if (caps->known) {
+      ops[k]->ret = SMART_RELAY_OK;
+    } else {
+      ops[k]->ret = caps->error != SMART_RELAY_OK ? caps->error : SMART_RELAY_ERR_PARAM;
+    }
+  }
+
+  // Write phase: one Relay Set Mask frame per capable board, back-to-back.
+  for (uint8_t k = 0; k < n; k++) {
+    smart_relay_caps_t *caps = &ops[k]->board->caps;
+    sent[k] = 0;
+    if (ops[k]->ret == SMART_RELAY_OK && (caps->caps & SMART_RELAY_CAP_RELAY_MASK) && caps->dev->sync == 0) {
+      ops[k]->ret = smart_relay_relay_set_mask_send(caps->dev, ops[k]->relay_mask, ops[k]->state_mask);
+      sent[k] = ops[k]->ret == SMART_RELAY_OK;
+    }
+  }
+
+  // Status sweep; BUSY boards and boards without the mask command go
+  // through the routed (retrying, per-relay fallback) path.
+  uint8_t failed = 0;
+  for (uint8_t k = 0; k < n; k++) {
+    smart_relay_plan_op_t *op = ops[k];
+    if (sent[k]) {
+      op->ret = smart_relay_read_pending(op->board->caps.dev);
+      if (op->ret == SMART_RELAY_OK) {
+        op->done_mask = op->relay_mask;
+      } else if (op->ret == SMART_RELAY_ERR_BUSY) {
+        op->ret = smart_relay_caps_relay_set_mask_ex(&op->board->caps, op->relay_mask, op->state_mask,
+                                                     &op->done_mask);
+      }
+    } else if (op->ret == SMART_RELAY_OK) {
+      op->ret = smart_relay_caps_relay_set_mask_ex(&op->board->caps, op->relay_mask, op->state_mask,
+                                                   &op->done_mask);
+    }
+    if (op->ret != SMART_RELAY_OK) {
+      failed++;
+    }
+  }
+  return failed;
+}
+
+uint8_t smart_relay_plan_execute(smart_relay_plan_t *plan) {
+  if (plan == 0) {
+    return 0;
+  }
+  uint8_t failed = 0;
+  for (uint8_t i = 0; i < plan->count; i++) {
+    // Each bus once, at its first op.
+    uint8_t bus = plan->ops[i].board->bus;
+    uint8_t seen = 0;
+    for (uint8_t j = 0; j < i && !seen; j++) {
+      seen = plan->ops[j].board->bus == bus;
+    }
+    if (!seen) {
+      failed = (uint8_t)(failed + smart_relay_plan_execute_bus(plan, bus));
+    }
+  }
+  return failed;
+}
+
+int smart_relay_plan_result(const smart_relay_plan_t *plan, const smart_relay_member_t *member) {
+  if (plan == 0 || member == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  for (uint8_t i = 0; i < plan->count; i++) {
+    const smart_relay_plan_op_t *op = &plan->ops[i];
+    if (op->board == member->board) {
+      return (op->done_mask & (1U << member->relay_id)) ? SMART_RELAY_OK : op->ret;
+    }
+  }
+  return SMART_RELAY_ERR_PARAM;
+}
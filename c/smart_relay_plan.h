@@ -0,0 +1,68 @@
+#ifndef SMART_RELAY_PLAN_C_H
+#define SMART_RELAY_PLAN_C_H
+
+#include <stdint.h>
+#include "smart_relay.h"
+#include "smart_relay_caps.h"
+
+// Logical relay groups ("zone 3 lights") spanning several boards and buses.
+// A plan collects group operations, merges them into one relay/state mask
+// per board and executes each board's share in as few transactions as its
+// firmware allows (see smart_relay_caps.h). On each bus the Relay Set Mask
+// frames go out back-to-back, so every board switches within one frame time
+// of the previous one, and the statuses are swept afterwards. Different
+// buses are independent: run smart_relay_plan_execute_bus() for each bus in
+// its own thread, or smart_relay_plan_execute() for all of them in turn.
+// Execution only reads capabilities, since the cache shared between buses
+// is not thread-safe: query every board (smart_relay_caps_query) first.
+
+#define SMART_RELAY_PLAN_MAX_OPS 32
+
+typedef struct {
+  smart_relay_caps_t caps;  // device handle and its capabilities
+  uint8_t bus;              // index of the bus the board sits on
+} smart_relay_board_t;
+
+typedef struct {
+  smart_relay_board_t *board;
+  uint8_t relay_id;
+} smart_relay_member_t;
+
+typedef struct {
+  const smart_relay_member_t *members;
+  uint8_t count;
+} smart_relay_load_t;
+
+typedef struct {
+  smart_relay_board_t *board;
+  uint8_t relay_mask;
+  uint8_t state_mask;
+  uint8_t done_mask;  // relays the board acknowledged, after execution
+  int ret;            // board result after execution
+} smart_relay_plan_op_t;
+
+typedef struct {
+  smart_relay_plan_op_t ops[SMART_RELAY_PLAN_MAX_OPS];
+  uint8_t count;
+} smart_relay_plan_t;
+
+void smart_relay_plan_init(smart_relay_plan_t *plan);
+
+// Adds "turn load on/off". A relay set twice keeps the last state.
+// Returns SMART_RELAY_ERR_PARAM for a bad member or when the plan runs out of
+// board slots; the plan is then left unchanged.
+int smart_relay_plan_add(smart_relay_plan_t *plan, const smart_relay_load_t *load, uint8_t on);
+
+// Executes the ops of one bus. Returns how many boards on it failed. Boards
+// whose capabilities are not known fail with the error of their last query
+// (SMART_RELAY_ERR_PARAM if never queried); query them again once they answer.
+uint8_t smart_relay_plan_execute_bus(smart_relay_plan_t *plan, uint8_t bus);
+// Executes every bus in turn. Returns how many boards failed.
+uint8_t smart_relay_plan_execute(smart_relay_plan_t *plan);
+
+// Result for one member after execution: SMART_RELAY_OK if its relay was
+// switched, even when a later relay on the same board failed (boards without
+// Relay Set Mask are switched one relay at a time), else the board's error.
+int smart_relay_plan_result(const smart_relay_plan_t *plan, const smart_relay_member_t *member);
+
+#endif // SMART_RELAY_PLAN_C_H
@@ -0,0 +1,281 @@
+#include "smart_relay_profile.h"
+
+#include <string.h>
+
+void smart_relay_profile_init(smart_relay_profile_t *profile) {
+  if (profile == 0) {
+    return;
+  }
+  memset(profile, 0, sizeof(*profile));
+}
+
+void smart_relay_profile_set_watchdog(smart_relay_profile_t *profile, uint8_t relay_id, uint16_t ping_timeout_sec,
+                                      uint16_t reset_duration_sec, uint8_t reset_active_state) {
+  if (profile == 0) {
+    return;
+  }
+  profile->fields |= SMART_RELAY_PROFILE_MODE | SMART_RELAY_PROFILE_WD_PING_TIMEOUT |
+                     SMART_RELAY_PROFILE_WD_RESET_DURATION | SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE;
+  profile->mode = SMART_RELAY_MODE_WATCHDOG;
+  profile->mode_relay = relay_id;
+  profile->pc_sleep_enable = 0;
+  profile->wd_ping_timeout_sec = ping_timeout_sec;
+  profile->wd_reset_duration_sec = reset_duration_sec;
+  profile->wd_reset_active_state = reset_active_state ? 1 : 0;
+}
+
+void smart_relay_profile_set_power_cycle(smart_relay_profile_t *profile, uint8_t relay_id, uint16_t max_on_sec,
+                                         uint8_t sleep_enable) {
+  if (profile == 0) {
+    return;
+  }
+  profile->fields |= SMART_RELAY_PROFILE_MODE | SMART_RELAY_PROFILE_PC_MAX_ON_TIME;
+  profile->mode = SMART_RELAY_MODE_POWER_CYCLE;
+  profile->mode_relay = relay_id;
+  profile->pc_sleep_enable = sleep_enable ? 1 : 0;
+  profile->pc_max_on_sec = max_on_sec;
+}
+
+void smart_relay_profile_set_no_mode(smart_relay_profile_t *profile) {
+  if (profile == 0) {
+    return;
+  }
+  profile->fields |= SMART_RELAY_PROFILE_MODE;
+  profile->mode = SMART_RELAY_MODE_NONE;
+}
+
+void smart_relay_profile_set_relay_persist(smart_relay_profile_t *profile, uint8_t enabled) {
+  if (profile == 0) {
+    return;
+  }
+  profile->fields |= SMART_RELAY_PROFILE_RELAY_PERSIST;
+  profile->relay_persist = enabled ? 1 : 0;
+}
+
+static uint8_t known_matches(const smart_relay_profile_t *known, const smart_relay_profile_t *profile, uint16_t field) {
+  if (known == 0 || !(known->fields & field)) {
+    return 0;
+  }
+  switch (field) {
+    case SMART_RELAY_PROFILE_MODE:
+      if (known->mode != profile->mode) return 0;
+      if (profile->mode == SMART_RELAY_MODE_NONE) return 1;
+      if (known->mode_relay != profile->mode_relay) return 0;
+      return profile->mode != SMART_RELAY_MODE_POWER_CYCLE || known->pc_sleep_enable == profile->pc_sleep_enable;
+    case SMART_RELAY_PROFILE_WD_PING_TIMEOUT:
+      return known->wd_ping_timeout_sec == profile->wd_ping_timeout_sec;
+    case SMART_RELAY_PROFILE_WD_RESET_DURATION:
+      return known->wd_reset_duration_sec == profile->wd_reset_duration_sec;
+    case SMART_RELAY_PROFILE_PC_MAX_ON_TIME:
+      return known->pc_max_on_sec == profile->pc_max_on_sec;
+    default:
+      return 0;
+  }
+}
+
+// Parameters of each mode
+#define PROFILE_WD_PARAMS (SMART_RELAY_PROFILE_WD_PING_TIMEOUT | SMART_RELAY_PROFILE_WD_RESET_DURATION | \
+                           SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE)
+#define PROFILE_PC_PARAMS SMART_RELAY_PROFILE_PC_MAX_ON_TIME
+
+// Internal step: leave the running mode before its parameters change.
+#define PROFILE_LEAVE (1U << 15)
+
+// Counts a write the device acknowledged; BUSY retries are not counted.
+static int acked(smart_relay_profile_report_t *report, int ret) {
+  if (ret == SMART_RELAY_OK) {
+    report->writes++;
+  }
+  return ret;
+}
+
+// running is the mode on the device, 0xFF if unknown (disable both).
+static int disable_mode(smart_relay_t *dev, uint8_t running, smart_relay_profile_report_t *report) {
+  int ret = SMART_RELAY_OK;
+  if (running == SMART_RELAY_MODE_WATCHDOG || running == 0xFF) {
+    ret = acked(report, smart_relay_watchdog_disable(dev));
+    if (ret != SMART_RELAY_OK) return ret;
+  }
+  if (running == SMART_RELAY_MODE_POWER_CYCLE || running == 0xFF) {
+    ret = acked(report, smart_relay_power_cycle_disable(dev));
+  }
+  return ret;
+}
+
+// Mode running on the device: from known if it has one, else from Get All
+// Status. 0xFF if neither can tell.
+static uint8_t running_mode(smart_relay_t *dev, const smart_relay_profile_t *known,
+                            smart_relay_profile_report_t *report) {
+  if (known != 0 && (known->fields & SMART_RELAY_PROFILE_MODE)) {
+    return known->mode;
+  }
+  smart_relay_status_t status;
+  report->reads++;
+  if (smart_relay_get_all_status(dev, &status) != SMART_RELAY_OK) {
+    return 0xFF;
+  }
+  return status.mode;
+}
+
+static int write_field(smart_relay_t *dev, const smart_relay_profile_t *profile, uint8_t running, uint16_t field,
+                       smart_relay_profile_report_t *report) {
+  switch (field) {
+    case PROFILE_LEAVE:
+      return disable_mode(dev, running, report);
+    case SMART_RELAY_PROFILE_MODE:
+      if (profile->mode == SMART_RELAY_MODE_WATCHDOG) {
+        return acked(report, smart_relay_watchdog_enable(dev, profile->mode_relay));
+      }
+      if (profile->mode == SMART_RELAY_MODE_POWER_CYCLE) {
+        return acked(report, smart_relay_power_cycle_enable_ex(dev, profile->mode_relay, profile->pc_sleep_enable));
+      }
+      return disable_mode(dev, running, report);
+    case SMART_RELAY_PROFILE_WD_PING_TIMEOUT:
+      return acked(report, smart_relay_watchdog_set_ping_timeout(dev, profile->wd_ping_timeout_sec));
+    case SMART_RELAY_PROFILE_WD_RESET_DURATION:
+      return acked(report, smart_relay_watchdog_set_reset_duration(dev, profile->wd_reset_duration_sec));
+    case SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE:
+      return acked(report, smart_relay_watchdog_set_reset_active_state(dev, profile->wd_reset_active_state));
+    case SMART_RELAY_PROFILE_PC_MAX_ON_TIME:
+      return acked(report, smart_relay_power_cycle_set_max_on_time(dev, profile->pc_max_on_sec));
+    case SMART_RELAY_PROFILE_RELAY_PERSIST:
+      return acked(report, profile->relay_persist ? smart_relay_relay_state_persist_enable(dev)
+                                                  : smart_relay_relay_state_persist_disable(dev));
+    default:
+      return SMART_RELAY_ERR_PARAM;
+  }
+}
+
+static int write_with_retry(smart_relay_t *dev, const smart_relay_profile_t *profile, uint8_t running, uint16_t field,
+                            smart_relay_profile_report_t *report) {
+  int ret = write_field(dev, profile, running, field, report);
+  for (uint8_t attempt = 0; ret == SMART_RELAY_ERR_BUSY && attempt < SMART_RELAY_PROFILE_BUSY_RETRIES; attempt++) {
+    if (dev->delay_ms) {
+      dev->delay_ms((uint16_t)(SMART_RELAY_PROFILE_BUSY_DELAY_MS << attempt));
+    }
+    ret = write_field(dev, profile, running, field, report);
+  }
+  return ret;
+}
+
+static int read_field(smart_relay_t *dev, uint16_t field, uint8_t *out_value, smart_relay_profile_report_t *report) {
+  report->reads++;
+  if (field == SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE) {
+    return smart_relay_watchdog_get_reset_active_state(dev, out_value);
+  }
+  if (field == SMART_RELAY_PROFILE_RELAY_PERSIST) {
+    int ret = smart_relay_relay_state_persist_get(dev, out_value);
+    *out_value = *out_value ? 1 : 0;
+    return ret;
+  }
+  return SMART_RELAY_ERR_PARAM;
+}
+
+static uint8_t desired_readable(const smart_relay_profile_t *profile, uint16_t field) {
+  return field == SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE ? profile->wd_reset_active_state : profile->relay_persist;
+}
+
+int smart_relay_profile_apply(smart_relay_t *dev, const smart_relay_profile_t *profile,
+                              const smart_relay_profile_t *known, smart_relay_profile_report_t *report) {
+  if (dev == 0 || profile == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  smart_relay_profile_report_t local;
+  if (report == 0) {
+    report = &local;
+  }
+  memset(report, 0, sizeof(*report));
+
+  uint16_t todo = profile->fields;
+
+  // Diff: read back what the protocol exposes, trust known for the rest.
+  static const uint16_t readable[] = {
+    SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE,
+    SMART_RELAY_PROFILE_RELAY_PERSIST
+  };
+  for (uint8_t i = 0; i < sizeof(readable) / sizeof(readable[0]); i++) {
+    uint16_t field = readable[i];
+    uint8_t value = 0;
+    if ((todo & field) && read_field(dev, field, &value, report) == SMART_RELAY_OK &&
+        value == desired_readable(profile, field)) {
+      todo &= (uint16_t)~field;
+      report->skipped |= field;
+    }
+  }
+  for (uint16_t field = 1; field <= SMART_RELAY_PROFILE_RELAY_PERSIST; field <<= 1) {
+    if ((todo & field) && !(field & SMART_RELAY_PROFILE_READABLE) && known_matches(known, profile, field)) {
+      todo &= (uint16_t)~field;
+      report->skipped |= field;
+    }
+  }
+
+  // Safe order: leave the running mode before touching its parameters, and
+  // enter a mode only after its parameters are in place. Enabling one mode
+  // disables the other on the device, so switching modes never needs an
+  // explicit disable.
+  uint8_t running = 0xFF;
+  if (todo & (SMART_RELAY_PROFILE_MODE | PROFILE_WD_PARAMS | PROFILE_PC_PARAMS)) {
+    running = running_mode(dev, known, report);
+  }
+  if ((todo & SMART_RELAY_PROFILE_MODE) && profile->mode == SMART_RELAY_MODE_NONE &&
+      running == SMART_RELAY_MODE_NONE) {
+    todo &= (uint16_t)~SMART_RELAY_PROFILE_MODE;
+    report->skipped |= SMART_RELAY_PROFILE_MODE;
+  }
+  uint16_t leave_first = 0;
+  if ((todo & SMART_RELAY_PROFILE_MODE) && profile->mode == SMART_RELAY_MODE_NONE) {
+    leave_first = SMART_RELAY_PROFILE_MODE;
+  } else if ((profile->fields & SMART_RELAY_PROFILE_MODE) &&
+             (((todo & PROFILE_WD_PARAMS) && (running == SMART_RELAY_MODE_WATCHDOG || running == 0xFF)) ||
+              ((todo & PROFILE_PC_PARAMS) && (running == SMART_RELAY_MODE_POWER_CYCLE || running == 0xFF)))) {
+    // Only with a mode in the profile: the mode is entered again at the end.
+    leave_first = PROFILE_LEAVE;
+    todo |= PROFILE_LEAVE;
+    if (profile->mode != SMART_RELAY_MODE_NONE) {
+      todo |= SMART_RELAY_PROFILE_MODE;
+      report->skipped &= (uint16_t)~SMART_RELAY_PROFILE_MODE;
+    }
+  }
+
+  uint16_t order[7];
+  uint8_t count = 0;
+  if (leave_first) order[count++] = leave_first;
+  order[count++] = SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE;
+  order[count++] = SMART_RELAY_PROFILE_WD_PING_TIMEOUT;
+  order[count++] = SMART_RELAY_PROFILE_WD_RESET_DURATION;
+  order[count++] = SMART_RELAY_PROFILE_PC_MAX_ON_TIME;
+  order[count++] = SMART_RELAY_PROFILE_RELAY_PERSIST;
+  if (leave_first != SMART_RELAY_PROFILE_MODE) order[count++] = SMART_RELAY_PROFILE_MODE;
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint16_t field = order[i];
+    if (!(todo & field)) {
+      continue;
+    }
+    int ret = write_with_retry(dev, profile, running, field, report);
+    if (ret != SMART_RELAY_OK) {
+      // Stop here so a mode is never entered with stale parameters.
+      report->failed |= field == PROFILE_LEAVE ? SMART_RELAY_PROFILE_MODE : field;
+      return ret;
+    }
+    if (field != PROFILE_LEAVE) {
+      report->written |= field;
+    }
+  }
+
+  // Verify what can be read back.
+  int result = SMART_RELAY_OK;
+  for (uint8_t i = 0; i < sizeof(readable) / sizeof(readable[0]); i++) {
+    uint16_t field = readable[i];
+    uint8_t value = 0;
+    if (!(report->written & field)) {
+      continue;
+    }
+    int ret = read_field(dev, field, &value, report);
+    if (ret != SMART_RELAY_OK || value != desired_readable(profile, field)) {
+      report->failed |= field;
+      result = (ret != SMART_RELAY_OK) ? ret : SMART_RELAY_ERR_VERIFY;
+    }
+  }
+  return result;
+}
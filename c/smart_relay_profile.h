@@ -0,0 +1,60 @@
+#ifndef SMART_RELAY_PROFILE_C_H
+#define SMART_RELAY_PROFILE_C_H
+
+#include <stdint.h>
+#include "smart_relay.h"
+
+// Declarative configuration profiles. smart_relay_profile_apply() reads back
+// what the protocol allows, skips fields that already match, writes the rest
+// in a mode-safe order and verifies the result. Every skipped field is one
+// EEPROM write and one BUSY window saved.
+
+// Profile field bits
+#define SMART_RELAY_PROFILE_MODE                  (1U << 0)
+#define SMART_RELAY_PROFILE_WD_PING_TIMEOUT       (1U << 1)
+#define SMART_RELAY_PROFILE_WD_RESET_DURATION     (1U << 2)
+#define SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE (1U << 3)
+#define SMART_RELAY_PROFILE_PC_MAX_ON_TIME        (1U << 4)
+#define SMART_RELAY_PROFILE_RELAY_PERSIST         (1U << 5)
+
+// Fields the protocol can read back
+#define SMART_RELAY_PROFILE_READABLE (SMART_RELAY_PROFILE_WD_RESET_ACTIVE_STATE | SMART_RELAY_PROFILE_RELAY_PERSIST)
+
+#define SMART_RELAY_PROFILE_BUSY_RETRIES 3
+#define SMART_RELAY_PROFILE_BUSY_DELAY_MS 20
+
+typedef struct {
+  uint16_t fields;  // SMART_RELAY_PROFILE_* bits that are set in this profile
+  uint8_t mode;
+  uint8_t mode_relay;
+  uint8_t pc_sleep_enable;
+  uint8_t wd_reset_active_state;
+  uint8_t relay_persist;
+  uint16_t wd_ping_timeout_sec;
+  uint16_t wd_reset_duration_sec;
+  uint16_t pc_max_on_sec;
+} smart_relay_profile_t;
+
+typedef struct {
+  uint16_t written;   // fields written to the device
+  uint16_t skipped;   // fields already matching
+  uint16_t failed;    // fields whose write or verify failed
+  uint8_t writes;     // writes the device acknowledged (EEPROM writes)
+  uint8_t reads;      // readback transactions issued
+} smart_relay_profile_report_t;
+
+void smart_relay_profile_init(smart_relay_profile_t *profile);
+void smart_relay_profile_set_watchdog(smart_relay_profile_t *profile, uint8_t relay_id, uint16_t ping_timeout_sec,
+                                      uint16_t reset_duration_sec, uint8_t reset_active_state);
+void smart_relay_profile_set_power_cycle(smart_relay_profile_t *profile, uint8_t relay_id, uint16_t max_on_sec,
+                                         uint8_t sleep_enable);
+void smart_relay_profile_set_no_mode(smart_relay_profile_t *profile);
+void smart_relay_profile_set_relay_persist(smart_relay_profile_t *profile, uint8_t enabled);
+
+// Applies profile to dev. Write-only fields (mode, timeouts, max on time) are
+// compared against known, the last profile applied to this device, if given.
+// On success the caller can store profile as the next known baseline.
+int smart_relay_profile_apply(smart_relay_t *dev, const smart_relay_profile_t *profile,
+                              const smart_relay_profile_t *known, smart_relay_profile_report_t *report);
+
+#endif // SMART_RELAY_PROFILE_C_H
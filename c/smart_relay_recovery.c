@@ -0,0 +1,161 @@
+#include "smart_relay_recovery.h"
+
+#include <string.h>
+
+static uint8_t interrupted(int ret) {
+  // BUSY and status errors are clean answers; only these leave the outcome open.
+  return (ret == SMART_RELAY_ERR_IO || ret == SMART_RELAY_ERR_PEC) ? 1 : 0;
+}
+
+static uint32_t now_us(const smart_relay_recovery_t *rec) {
+  return rec->micros != 0 ? rec->micros() : 0;
+}
+
+// Relay Get State as the liveness probe. A device that browned out comes
+// back with PEC off and answers plain frames, which fail our CRC check; in
+// that case PEC is renegotiated before the session carries on.
+static int probe(smart_relay_recovery_t *rec, smart_relay_t *dev, uint8_t *state_mask, uint8_t *init_mask) {
+  int ret = smart_relay_relay_get_state(dev, state_mask, init_mask);
+  if (ret != SMART_RELAY_ERR_PEC || !dev->pec) {
+    return ret;
+  }
+  ret = smart_relay_pec_resync(dev);
+  if (ret != SMART_RELAY_OK) return ret;
+  rec->resyncs++;
+  return smart_relay_relay_get_state(dev, state_mask, init_mask);
+}
+
+void smart_relay_recovery_init(smart_relay_recovery_t *rec, int (*clock_out)(void), int (*bus_reset)(void),
+                               uint32_t (*micros)(void)) {
+  if (rec == 0) {
+    return;
+  }
+  memset(rec, 0, sizeof(*rec));
+  rec->clock_out = clock_out;
+  rec->bus_reset = bus_reset;
+  rec->micros = micros;
+  rec->max_attempts = SMART_RELAY_RECOVERY_ATTEMPTS;
+  rec->max_retries = SMART_RELAY_RECOVERY_RETRIES;
+}
+
+int smart_relay_recovery_recover(smart_relay_recovery_t *rec, smart_relay_t *dev, uint8_t *out_state_mask,
+                                 uint8_t *out_init_mask) {
+  if (rec == 0 || dev == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  uint8_t state_mask = 0;
+  uint8_t init_mask = 0;
+  uint16_t backoff_ms = 1;
+  uint32_t start = now_us(rec);
+  int ret = SMART_RELAY_ERR_IO;
+
+  for (uint8_t attempt = 0; attempt < rec->max_attempts; attempt++) {
+    // A stuck SDA is the common case and nine clocks are cheap; the adapter
+    // reset comes next; anything still failing is treated as a NACK storm
+    // (device busy in EEPROM writes, noisy bus) and waited out.
+    if (attempt == 0) {
+      if (rec->clock_out != 0) {
+        rec->clock_outs++;
+        rec->clock_out();
+      }
+    } else if (attempt == 1) {
+      if (rec->bus_reset != 0) {
+        rec->bus_resets++;
+        rec->bus_reset();
+      }
+      if (rec->clock_out != 0) {
+        rec->clock_outs++;
+        rec->clock_out();
+      }
+    } else if (dev->delay_ms != 0) {
+      dev->delay_ms(backoff_ms);
+      if (backoff_ms < SMART_RELAY_RECOVERY_BACKOFF_MAX_MS) {
+        backoff_ms = (uint16_t)(backoff_ms * 2);
+      }
+    }
+
+    ret = probe(rec, dev, &state_mask, &init_mask);
+    if (!interrupted(ret) && ret != SMART_RELAY_ERR_BUSY) {
+      break;
+    }
+  }
+
+  if (ret != SMART_RELAY_OK) {
+    rec->failures++;
+    return ret;
+  }
+  uint32_t elapsed = now_us(rec) - start;
+  rec->recoveries++;
+  rec->last_us = elapsed;
+  if (elapsed > rec->max_us) {
+    rec->max_us = elapsed;
+  }
+  rec->total_us += elapsed;
+  if (out_state_mask != 0) {
+    *out_state_mask = state_mask;
+  }
+  if (out_init_mask != 0) {
+    *out_init_mask = init_mask;
+  }
+  return SMART_RELAY_OK;
+}
+
+int smart_relay_recovery_relay_set(smart_relay_recovery_t *rec, smart_relay_t *dev, uint8_t relay_id, uint8_t on) {
+  if (rec == 0 || dev == 0 || relay_id > 7) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  int ret = on ? smart_relay_relay_on(dev, relay_id) : smart_relay_relay_off(dev, relay_id);
+  if (!interrupted(ret)) {
+    return ret;
+  }
+  rec->interrupted++;
+
+  uint8_t bit = (uint8_t)(1U << relay_id);
+  for (uint8_t retry = 0; retry <= rec->max_retries; retry++) {
+    uint8_t state_mask = 0;
+    uint8_t init_mask = 0;
+    ret = smart_relay_recovery_recover(rec, dev, &state_mask, &init_mask);
+    if (ret != SMART_RELAY_OK) {
+      return ret;
+    }
+    // The command was either executed before the abort or never seen; the
+    // relay state tells which, and re-sending is only needed in the latter.
+    if ((init_mask & bit) && (((state_mask & bit) != 0) == (on != 0))) {
+      rec->applied++;
+      return SMART_RELAY_OK;
+    }
+    if (retry == rec->max_retries) {
+      break;
+    }
+    rec->retried++;
+    ret = on ? smart_relay_relay_on(dev, relay_id) : smart_relay_relay_off(dev, relay_id);
+    if (!interrupted(ret)) {
+      return ret;
+    }
+  }
+  return SMART_RELAY_ERR_VERIFY;
+}
+
+int smart_relay_recovery_run(smart_relay_recovery_t *rec, smart_relay_t *dev, int (*op)(smart_relay_t *dev, void *arg),
+                             void *arg) {
+  if (rec == 0 || dev == 0 || op == 0) {
+    return SMART_RELAY_ERR_PARAM;
+  }
+  int ret = op(dev, arg);
+  if (!interrupted(ret)) {
+    return ret;
+  }
+  rec->interrupted++;
+  for (uint8_t retry = 0; retry < rec->max_retries; retry++) {
+    int rec_ret = smart_relay_recovery_recover(rec, dev, 0, 0);
+    if (rec_ret != SMART_RELAY_OK) {
+      return rec_ret;
+    }
+    rec->retried++;
+    ret = op(dev, arg);
+    if (!interrupted(ret)) {
+      return ret;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,61 @@
+#ifndef SMART_RELAY_RECOVERY_C_H
+#define SMART_RELAY_RECOVERY_C_H
+
+#include <stdint.h>
+#include "smart_relay.h"
+
+// Bus fault recovery and session re-sync. A transfer that aborts mid-byte
+// leaves two questions: is the bus still usable, and did the device act on
+// the command before the abort? The recovery engine answers the first by
+// escalating clock-out -> adapter reset -> backoff until Relay Get State
+// succeeds, and the second by comparing that state with what was asked for.
+
+// Default policy
+#define SMART_RELAY_RECOVERY_ATTEMPTS 8
+#define SMART_RELAY_RECOVERY_RETRIES 2
+#define SMART_RELAY_RECOVERY_BACKOFF_MAX_MS 64
+
+typedef struct {
+  // Platform hooks, any may be 0. clock_out pulses SCL up to nine times
+  // until the slave releases SDA, then issues a STOP; it returns 0 when SDA
+  // reads high. bus_reset re-initializes the I2C adapter. micros feeds the
+  // recovery time metrics.
+  int (*clock_out)(void);
+  int (*bus_reset)(void);
+  uint32_t (*micros)(void);
+
+  uint8_t max_attempts;  // probes per recovery before giving up
+  uint8_t max_retries;   // re-sends of an interrupted command
+
+  // Metrics
+  uint32_t interrupted;  // commands that ended in an I/O or PEC error
+  uint32_t recoveries;   // bus brought back
+  uint32_t failures;     // bus not brought back within max_attempts
+  uint32_t clock_outs;
+  uint32_t bus_resets;
+  uint32_t resyncs;      // PEC mode lost by the device and renegotiated
+  uint32_t applied;      // interrupted commands found already applied
+  uint32_t retried;      // interrupted commands sent again
+  uint32_t last_us;      // duration of the last recovery
+  uint32_t max_us;
+  uint64_t total_us;
+} smart_relay_recovery_t;
+
+void smart_relay_recovery_init(smart_relay_recovery_t *rec, int (*clock_out)(void), int (*bus_reset)(void),
+                               uint32_t (*micros)(void));
+
+// Brings the bus back after an I/O error and returns the relay state read
+// while probing (either output pointer may be 0).
+int smart_relay_recovery_recover(smart_relay_recovery_t *rec, smart_relay_t *dev, uint8_t *out_state_mask,
+                                 uint8_t *out_init_mask);
+
+// Relay On/Off that survives an interrupted transfer: after recovery the
+// relay state decides between "already applied" and "send again".
+int smart_relay_recovery_relay_set(smart_relay_recovery_t *rec, smart_relay_t *dev, uint8_t relay_id, uint8_t on);
+
+// Runs op and, on an I/O or PEC error, recovers and runs it again. Only for
+// commands that are safe to repeat (reads, setters, pings).
+int smart_relay_recovery_run(smart_relay_recovery_t *rec, smart_relay_t *dev, int (*op)(smart_relay_t *dev, void *arg),
+                             void *arg);
+
+#endif // SMART_RELAY_RECOVERY_C_H
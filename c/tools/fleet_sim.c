@@ -0,0 +1,420 @@
+// Discrete-event fleet simulator for bus capacity planning.
+//
+// Drives N simulated devices on one bus through the real C library
+// (smart_relay_t over c/sim/) with a periodic/Poisson workload mix, and
+// reports bus utilization, queueing delay distributions and watchdog
+// deadline misses. Hours of virtual time run in seconds.
+//
+// Build:
+//   cc -std=c99 -O2 -I.. fleet_sim.c ../smart_relay.c ../sim/smart_relay_sim.c -o fleet_sim
+// Example:
+//   ./fleet_sim --devices 40 --clock 100000 --hours 2 --ping-ms 1000 --timeout-s 3
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../smart_relay.h"
+#include "../sim/smart_relay_sim.h"
+
+enum {
+  JOB_PING = 0,
+  JOB_POLL = 1,
+  JOB_SWITCH = 2,
+  JOB_TRIPS = 3,
+  JOB_KIND_COUNT = 4
+};
+
+static const char *job_names[JOB_KIND_COUNT] = { "ping", "poll", "switch", "trips" };
+
+#define HIST_BUCKETS 320
+
+typedef struct {
+  uint32_t count;
+  uint32_t failed;
+  uint64_t wire_us;
+  uint64_t sum_us;
+  uint64_t max_us;
+  uint32_t hist[HIST_BUCKETS];
+} delay_stats_t;
+
+typedef struct {
+  uint64_t time_us;
+  uint8_t device;
+  uint8_t kind;
+} arrival_t;
+
+typedef struct {
+  uint32_t devices;
+  uint32_t clock_hz;
+  double hours;
+  uint32_t ping_ms;
+  uint16_t timeout_s;
+  uint32_t poll_ms;
+  double switch_per_min;
+  uint32_t trips_ms;
+  uint32_t gap_us;
+  uint32_t seed;
+  int heartbeat;  // verify_every for the heartbeat fast path, -1 = plain pings
+  uint32_t batch;
+} config_t;
+
+static smart_relay_sim_bus_t bus;
+static smart_relay_t handles[SMART_RELAY_SIM_MAX_DEVICES];
+static smart_relay_heartbeat_t heartbeats[SMART_RELAY_SIM_MAX_DEVICES];
+static uint64_t last_ping_us[SMART_RELAY_SIM_MAX_DEVICES];
+static uint32_t rng_state;
+
+static arrival_t *heap;
+static uint32_t heap_len;
+
+static uint32_t next_random(void) {
+  uint32_t x = rng_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  rng_state = x;
+  return x;
+}
+
+static double uniform(void) {
+  return (next_random() + 0.5) / 4294967296.0;
+}
+
+static void heap_push(arrival_t a) {
+  uint32_t i = heap_len++;
+  while (i > 0) {
+    uint32_t parent = (i - 1) / 2;
+    if (heap[parent].time_us <= a.time_us) {
+      break;
+    }
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = a;
+}
+
+static arrival_t heap_pop(void) {
+  arrival_t top = heap[0];
+  arrival_t last = heap[--heap_len];
+  uint32_t i = 0;
+  for (;;) {
+    uint32_t child = 2 * i + 1;
+    if (child >= heap_len) {
+      break;
+    }
+    if (child + 1 < heap_len && heap[child + 1].time_us < heap[child].time_us) {
+      child++;
+    }
+    if (last.time_us <= heap[child].time_us) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+  return top;
+}
+
+// Log-linear buckets: exact below 16us, then 8 sub-buckets per power of two.
+static uint32_t bucket_of(uint64_t us) {
+  if (us < 16) {
+    return (uint32_t)us;
+  }
+  uint32_t e = 0;
+  while ((us >> e) >= 16) {
+    e++;
+  }
+  uint32_t idx = 16 + (e - 1) * 8 + (uint32_t)(((us >> e) & 7));
+  return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+static uint64_t bucket_upper(uint32_t idx) {
+  if (idx < 16) {
+    return idx;
+  }
+  uint32_t e = (idx - 16) / 8 + 1;
+  uint32_t sub = (idx - 16) % 8;
+  return ((uint64_t)(8 + sub + 1) << e) - 1;
+}
+
+static void record(delay_stats_t *st, uint64_t delay_us, int ok) {
+  st->count++;
+  if (!ok) {
+    st->failed++;
+  }
+  st->sum_us += delay_us;
+  if (delay_us > st->max_us) {
+    st->max_us = delay_us;
+  }
+  st->hist[bucket_of(delay_us)]++;
+}
+
+static uint64_t percentile(const delay_stats_t *st, double p) {
+  if (st->count == 0) {
+    return 0;
+  }
+  uint64_t target = (uint64_t)(p * st->count);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+    seen += st->hist[i];
+    if (seen > target) {
+      uint64_t upper = bucket_upper(i);
+      return upper < st->max_us ? upper : st->max_us;
+    }
+  }
+  return st->max_us;
+}
+
+static uint64_t interarrival_us(const config_t *cfg, uint8_t kind) {
+  switch (kind) {
+    case JOB_PING: return (uint64_t)cfg->ping_ms * 1000ULL;
+    case JOB_POLL: return (uint64_t)cfg->poll_ms * 1000ULL;
+    case JOB_TRIPS: return (uint64_t)cfg->trips_ms * 1000ULL;
+    default: {
+      // Poisson switching
+      double mean_us = 60e6 / cfg->switch_per_min;
+      double u = uniform();
+      double t = 0.0;
+      // -ln(u) without libm: series on the mantissa keeps the tool dependency free.
+      while (u < 0.5) {
+        u *= 2.0;
+        t += 0.6931471805599453;
+      }
+      double x = (u - 1.0) / (u + 1.0);
+      double x2 = x * x;
+      t -= 2.0 * x * (1.0 + x2 / 3.0 + x2 * x2 / 5.0 + x2 * x2 * x2 / 7.0);
+      return (uint64_t)(t * mean_us) + 1;
+    }
+  }
+}
+
+static int run_job(const config_t *cfg, uint8_t device, uint8_t kind) {
+  smart_relay_t *dev = &handles[device];
+  switch (kind) {
+    case JOB_PING:
+      if (cfg->batch) {
+        return smart_relay_heartbeat_ping_all(heartbeats, (uint8_t)cfg->devices) ? SMART_RELAY_ERR_IO : SMART_RELAY_OK;
+      }
+      if (cfg->heartbeat >= 0) {
+        return smart_relay_heartbeat_ping(&heartbeats[device]);
+      }
+      return smart_relay_watchdog_ping(dev);
+    case JOB_POLL: {
+      uint8_t state_mask = 0;
+      uint8_t init_mask = 0;
+      return smart_relay_relay_get_state(dev, &state_mask, &init_mask);
+    }
+    case JOB_SWITCH: {
+      // Relay 0 carries the watchdog; switch the others.
+      uint8_t relay_id = (uint8_t)(1 + next_random() % (SMART_RELAY_SIM_DEFAULT_RELAYS - 1));
+      return (next_random() & 1) ? smart_relay_relay_on(dev, relay_id) : smart_relay_relay_off(dev, relay_id);
+    }
+    default: {
+      uint32_t count = 0;
+      return smart_relay_watchdog_get_trip_count(dev, &count);
+    }
+  }
+}
+
+static void usage(void) {
+  printf("usage: fleet_sim [options]\n"
+         "  --devices N          devices on the bus (default 16, max %d)\n"
+         "  --clock HZ           SCL rate (default 100000)\n"
+         "  --hours H            virtual time to simulate (default 1)\n"
+         "  --ping-ms MS         watchdog ping period per device (default 1000, 0=off)\n"
+         "  --timeout-s S        watchdog ping timeout (default 3)\n"
+         "  --poll-ms MS         relay state poll period per device (default 2000, 0=off)\n"
+         "  --switch-per-min R   relay switches per device per minute (default 2, 0=off)\n"
+         "  --trips-ms MS        trip count poll period per device (default 10000, 0=off)\n"
+         "  --gap-us US          host turnaround per transaction (default 50)\n"
+         "  --heartbeat N        use the heartbeat fast path, verifying every Nth ping\n"
+         "  --batch 1            ping the whole fleet back-to-back once per period\n"
+         "  --seed N             random seed (default 1)\n",
+         SMART_RELAY_SIM_MAX_DEVICES - 16);
+}
+
+static int parse_args(int argc, char **argv, config_t *cfg) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc) ? argv[i + 1] : 0;
+    if (strcmp(arg, "--help") == 0 || val == 0) {
+      return -1;
+    }
+    if (strcmp(arg, "--devices") == 0) cfg->devices = (uint32_t)strtoul(val, 0, 10);
+    else if (strcmp(arg, "--clock") == 0) cfg->clock_hz = (uint32_t)strtoul(val, 0, 10);
+    else if (strcmp(arg, "--hours") == 0) cfg->hours = strtod(val, 0);
+    else if (strcmp(arg, "--ping-ms") == 0) cfg->ping_ms = (uint32_t)strtoul(val, 0, 10);
+    else if (strcmp(arg, "--timeout-s") == 0) cfg->timeout_s = (uint16_t)strtoul(val, 0, 10);
+    else if (strcmp(arg, "--poll-ms") == 0) cfg->poll_ms = (uint32_t)strtoul(val, 0, 10);
+    else if (strcmp(arg, "--switch-per-min") == 0) cfg->switch_per_min = strtod(val, 0);
+    else if (strcmp(arg, "--trips-ms") == 0) cfg->trips_ms = (uint32_t)strtoul(val, 0, 10);
+    else if (strcmp(arg, "--gap-us") == 0) cfg->gap_us = (uint32_t)strtoul(val, 0, 10);
+    else if (strcmp(arg, "--heartbeat") == 0) cfg->heartbeat = (int)strtol(val, 0, 10);
+    else if (strcmp(arg, "--batch") == 0) cfg->batch = (uint32_t)strtoul(val, 0, 10);
+    else if (strcmp(arg, "--seed") == 0) cfg->seed = (uint32_t)strtoul(val, 0, 10);
+    else return -1;
+    i++;
+  }
+  if (cfg->devices == 0 || cfg->devices > SMART_RELAY_SIM_MAX_DEVICES - 16 || cfg->clock_hz == 0 ||
+      cfg->hours <= 0.0 || cfg->timeout_s == 0 || cfg->heartbeat > 255) {
+    return -1;
+  }
+  if (cfg->batch && cfg->heartbeat < 0) {
+    cfg->heartbeat = 0;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  config_t cfg = { 16, 100000, 1.0, 1000, 3, 2000, 2.0, 10000, 50, 1, -1, 0 };
+  if (parse_args(argc, argv, &cfg) != 0) {
+    usage();
+    return 1;
+  }
+  rng_state = cfg.seed ? cfg.seed : 1;
+
+  smart_relay_sim_init(&bus);
+  bus.clock_hz = cfg.clock_hz;
+  smart_relay_sim_attach(&bus);
+
+  // Provision: watchdog on relay 0 of every device.
+  for (uint32_t d = 0; d < cfg.devices; d++) {
+    uint8_t address = (uint8_t)(0x10 + d);
+    smart_relay_sim_add(&bus, address);
+    handles[d].address = address;
+    handles[d].i2c_write = smart_relay_sim_i2c_write;
+    handles[d].i2c_read = smart_relay_sim_i2c_read;
+    handles[d].delay_ms = smart_relay_sim_delay_ms;
+    smart_relay_heartbeat_init(&heartbeats[d], &handles[d], (uint8_t)(cfg.heartbeat > 0 ? cfg.heartbeat : 0));
+    if (cfg.ping_ms > 0) {
+      smart_relay_watchdog_set_ping_timeout(&handles[d], cfg.timeout_s);
+      smart_relay_sim_advance(&bus, 10);
+      smart_relay_watchdog_enable(&handles[d], 0);
+      smart_relay_sim_advance(&bus, 10);
+    }
+  }
+  // Provisioning a large fleet can outlast the ping timeout; restart every
+  // watchdog so the measurement window begins from a clean deadline.
+  if (cfg.ping_ms > 0) {
+    for (uint32_t d = 0; d < cfg.devices; d++) {
+      smart_relay_watchdog_ping(&handles[d]);
+    }
+  }
+
+  uint64_t start_us = bus.now_us;
+  uint64_t end_us = start_us + (uint64_t)(cfg.hours * 3600e6);
+  uint32_t trips_before = 0;
+  uint32_t busy_before = 0;
+  for (uint32_t d = 0; d < cfg.devices; d++) {
+    trips_before += bus.devices[d].trip_count;
+    busy_before += bus.devices[d].busy_replies;
+    last_ping_us[d] = start_us;
+  }
+
+  heap = (arrival_t *)malloc(sizeof(arrival_t) * cfg.devices * JOB_KIND_COUNT);
+  if (heap == 0) {
+    return 1;
+  }
+  uint8_t enabled[JOB_KIND_COUNT] = {
+    cfg.ping_ms > 0, cfg.poll_ms > 0, cfg.switch_per_min > 0.0, cfg.trips_ms > 0
+  };
+  for (uint32_t d = 0; d < cfg.devices; d++) {
+    for (uint8_t k = 0; k < JOB_KIND_COUNT; k++) {
+      if (!enabled[k] || (k == JOB_PING && cfg.batch && d > 0)) {
+        continue;
+      }
+      // Random phase so periodic streams do not all line up at t=0.
+      arrival_t a = { start_us + (uint64_t)(uniform() * (double)interarrival_us(&cfg, k)), (uint8_t)d, k };
+      heap_push(a);
+    }
+  }
+
+  delay_stats_t stats[JOB_KIND_COUNT];
+  memset(stats, 0, sizeof(stats));
+  uint64_t wire_us = 0;
+  uint64_t master_us = 0;
+  uint32_t late_pings = 0;
+  clock_t wall_start = clock();
+
+  // Single-server FIFO: jobs are served in arrival order, each starting when
+  // both the job has arrived and the bus master is free.
+  while (heap_len > 0 && heap[0].time_us < end_us) {
+    arrival_t a = heap_pop();
+    if (bus.now_us < a.time_us) {
+      smart_relay_sim_advance_us(&bus, a.time_us - bus.now_us);
+    }
+    uint64_t begin_us = bus.now_us;
+    int ret = run_job(&cfg, a.device, a.kind);
+    uint64_t done_us = bus.now_us;
+    wire_us += done_us - begin_us;
+    smart_relay_sim_advance_us(&bus, cfg.gap_us);
+    master_us += bus.now_us - begin_us;
+
+    record(&stats[a.kind], begin_us - a.time_us, ret == SMART_RELAY_OK);
+    stats[a.kind].wire_us += done_us - begin_us;
+    if (a.kind == JOB_PING) {
+      uint32_t first = cfg.batch ? 0 : a.device;
+      uint32_t last = cfg.batch ? cfg.devices - 1 : a.device;
+      for (uint32_t d = first; d <= last; d++) {
+        if (cfg.batch || ret == SMART_RELAY_OK) {
+          if (done_us - last_ping_us[d] > (uint64_t)cfg.timeout_s * 1000000ULL) {
+            late_pings++;
+          }
+          last_ping_us[d] = done_us;
+        }
+      }
+    }
+
+    a.time_us += interarrival_us(&cfg, a.kind);
+    heap_push(a);
+  }
+  if (bus.now_us < end_us) {
+    smart_relay_sim_advance_us(&bus, end_us - bus.now_us);
+  }
+  double wall_s = (double)(clock() - wall_start) / CLOCKS_PER_SEC;
+
+  uint32_t trips = 0;
+  uint32_t busy = 0;
+  for (uint32_t d = 0; d < cfg.devices; d++) {
+    trips += bus.devices[d].trip_count;
+    busy += bus.devices[d].busy_replies;
+  }
+  double span_us = (double)(end_us - start_us);
+
+  printf("fleet: %u devices, %u Hz, %.1f s virtual in %.2f s wall\n",
+         cfg.devices, cfg.clock_hz, span_us / 1e6, wall_s);
+  printf("bus utilization: wire %.1f%%, master %.1f%% (incl. %u us turnaround)\n",
+         100.0 * (double)wire_us / span_us, 100.0 * (double)master_us / span_us, cfg.gap_us);
+  printf("\nqueueing delay (us)   count  failed      mean       p50       p90       p99     p99.9       max  wire/job\n");
+  for (uint8_t k = 0; k < JOB_KIND_COUNT; k++) {
+    const delay_stats_t *st = &stats[k];
+    if (st->count == 0) {
+      continue;
+    }
+    printf("  %-8s %14u %7u %9.0f %9llu %9llu %9llu %9llu %9llu %9.0f\n",
+           job_names[k], st->count, st->failed, (double)st->sum_us / st->count,
+           (unsigned long long)percentile(st, 0.50), (unsigned long long)percentile(st, 0.90),
+           (unsigned long long)percentile(st, 0.99), (unsigned long long)percentile(st, 0.999),
+           (unsigned long long)st->max_us, (double)st->wire_us / st->count);
+  }
+  printf("\ndeadline misses: %u late pings (> %u s apart), %u watchdog trips\n",
+         late_pings, cfg.timeout_s, trips - trips_before);
+  printf("busy replies: %u\n", busy - busy_before);
+  if (cfg.heartbeat >= 0) {
+    uint32_t sent = 0;
+    uint32_t unverified = 0;
+    uint32_t nacks = 0;
+    uint64_t ping_wire_us = stats[JOB_PING].wire_us;
+    for (uint32_t d = 0; d < cfg.devices; d++) {
+      sent += heartbeats[d].sent;
+      unverified += heartbeats[d].unverified;
+      nacks += heartbeats[d].nacks;
+    }
+    printf("heartbeat: %u sent, %u unverified, %u nacks, %.0f us wire per device ping\n", sent, unverified, nacks,
+           sent ? (double)ping_wire_us / sent : 0.0);
+  }
+
+  free(heap);
+  return (trips - trips_before) > 0 ? 2 : 0;
+}
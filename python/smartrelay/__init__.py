@@ -31,10 +31,49 @@ CMD_EEPROM_GET_SHIFT_COUNT = 0x19
 CMD_FIRMWARE_GET_VERSION = 0x1A
 CMD_EEPROM_GET_VERSION = 0x1B
 CMD_DEVICE_INFO = 0x1C
+CMD_GET_ALL_STATUS = 0x21
+CMD_RELAY_SET_MASK = 0x22
+CMD_RELAY_ON_FOR_MS = 0x23
+CMD_RELAY_OFF_FOR_MS = 0x24
 
 # Status codes
 STATUS_OK = 0x00
 
+# Operating modes reported by get_all_status()
+MODE_NONE = 0
+MODE_WATCHDOG = 1
+MODE_POWER_CYCLE = 2
+
+# Get All Status block, version 1 (see docs/protocol.md)
+STATUS_BLOCK_VERSION = 1
+STATUS_BLOCK_LEN = 23
+
+
+def decode_status_block(block):
+    """Decode a Get All Status block (the bytes after the status byte)."""
+    if len(block) < STATUS_BLOCK_LEN or block[0] < STATUS_BLOCK_VERSION or block[1] < STATUS_BLOCK_LEN:
+        return None
+    flags = block[4]
+    return {
+        "version": block[0],
+        "state_mask": block[2],
+        "init_mask": block[3],
+        "relay_persist": bool(flags & 0x01),
+        "reset_active_state": 1 if flags & 0x02 else 0,
+        "wd_in_reset": bool(flags & 0x04),
+        "pc_off": bool(flags & 0x08),
+        "pc_sleep_enable": bool(flags & 0x10),
+        "mode": block[5],
+        "mode_relay": block[6],
+        "shift_count": block[7],
+        "trip_count": block[8] | (block[9] << 8) | (block[10] << 16) | (block[11] << 24),
+        "eeprom_write_count": block[12] | (block[13] << 8) | (block[14] << 16) | (block[15] << 24),
+        "wd_remaining_sec": block[16] | (block[17] << 8),
+        "pc_remaining_sec": block[18] | (block[19] << 8),
+        "timer_mask": block[20],
+        "next_timer_sec": block[21] | (block[22] << 8),
+    }
+
 
 class SmartRelay:
     def __init__(self, bus, address=0x2A):
@@ -63,6 +102,10 @@ class SmartRelay:
         self._send(CMD_RELAY_OFF, bytes([relay_id]))
         return self._read_status()
 
+    def relay_set_mask(self, relay_mask, state_mask):
+        self._send(CMD_RELAY_SET_MASK, bytes([relay_mask & 0xFF, state_mask & 0xFF]))
+        return self._read_status()
+
     def relay_on_for(self, relay_id, duration_sec):
         payload = bytes([relay_id, duration_sec & 0xFF, (duration_sec >> 8) & 0xFF])
         self._send(CMD_RELAY_ON_FOR, payload)
@@ -73,6 +116,16 @@ class SmartRelay:
         self._send(CMD_RELAY_OFF_FOR, payload)
         return self._read_status()
 
+    def relay_on_for_ms(self, relay_id, duration_ms):
+        payload = bytes([relay_id, duration_ms & 0xFF, (duration_ms >> 8) & 0xFF])
+        self._send(CMD_RELAY_ON_FOR_MS, payload)
+        return self._read_status()
+
+    def relay_off_for_ms(self, relay_id, duration_ms):
+        payload = bytes([relay_id, duration_ms & 0xFF, (duration_ms >> 8) & 0xFF])
+        self._send(CMD_RELAY_OFF_FOR_MS, payload)
+        return self._read_status()
+
     def watchdog_enable(self, relay_id):
         self._send(CMD_WATCHDOG_ENABLE, bytes([relay_id]))
         return self._read_status()
@@ -209,3 +262,11 @@ class SmartRelay:
         revision = resp[5]
         fw = resp[6] | (resp[7] << 8)
         return vendor, product, revision, fw
+
+    def get_all_status(self):
+        """Full health read in one round trip; None on error or older firmware."""
+        self._send(CMD_GET_ALL_STATUS, bytes([STATUS_BLOCK_LEN]))
+        resp = self._read(1 + STATUS_BLOCK_LEN)
+        if resp[0] != STATUS_OK:
+            return None
+        return decode_status_block(resp[1:])